@@ -12,6 +12,71 @@ use base qw(DynaLoader);
 
 bootstrap Tk::PNG $Tk::VERSION;
 
+package Tk::PNG::Progressive;
+
+sub new
+{
+ my ($class,$photo,%args) = @_;
+ my ($x,$y) = @{$args{'-to'} || [0,0]};
+ return bless { photo => $photo,
+                decoder => Tk::PNG::_progressive($photo,$x,$y) },$class;
+}
+
+sub feed
+{
+ my ($obj,$data) = @_;
+ return Tk::PNG::_feed($obj->{photo},$obj->{decoder},$data);
+}
+
+sub DESTROY
+{
+ my $obj = shift;
+ Tk::PNG::_progressive_free($obj->{decoder}) if $obj->{decoder};
+}
+
+package Tk::PNG::Context;
+
+sub new
+{
+ my ($class) = @_;
+ return bless { context => Tk::PNG::_context() },$class;
+}
+
+sub read
+{
+ my ($obj,$photo,%args) = @_;
+ my ($x,$y) = @{$args{'-to'} || [0,0]};
+ die "Tk::PNG::Context::read needs -file or -data\n"
+  unless defined($args{'-file'}) || defined($args{'-data'});
+ Tk::PNG::_context_read($photo,$obj->{context},$args{'-file'},$args{'-data'},
+                        $args{'-format'} || 'png',$x,$y);
+ return $photo;
+}
+
+sub write
+{
+ my ($obj,$photo,$file,%args) = @_;
+ Tk::PNG::_context_write($photo,$obj->{context},$file,
+                         $args{'-format'} || 'png');
+ return $photo;
+}
+
+sub data
+{
+ my ($obj,$photo,%args) = @_;
+ return Tk::PNG::_context_data($photo,$obj->{context},
+                               $args{'-format'} || 'png');
+}
+
+# A new thread makes its own context rather than share the parent's.
+sub CLONE_SKIP { 1 }
+
+sub DESTROY
+{
+ my $obj = shift;
+ Tk::PNG::_context_free($obj->{context}) if $obj->{context};
+}
+
 1;
 
 __END__
@@ -33,6 +98,62 @@ Tk::PNG - PNG loader for Tk::Photo
 This is an extension for Tk800.* which supplies
 PNG format loader for Photo image type.
 
+=head1 PROGRESSIVE LOADING
+
+  my $decoder = Tk::PNG::Progressive->new($image, -to => [$x, $y]);
+  $mw->fileevent($fh, readable => sub {
+      if (!sysread($fh, my $buf, 65536) || $decoder->feed($buf)) {
+          $mw->fileevent($fh, readable => '');
+          close($fh);
+      }
+  });
+
+A Tk::PNG::Progressive object decodes PNG data handed to it in pieces,
+for example as they arrive on a socket or pipe. Each call to C<feed>
+decodes what it can and puts the completed rows into the photo, so the
+image fills in while the event loop keeps running. Interlaced images
+appear coarse at first and are refined pass by pass; rows that no pass
+has reached yet are not put, and keep what the photo showed there.
+C<feed> returns true once the whole image has been decoded, and dies if
+the data is not a valid PNG image.
+
+=head1 REUSABLE CONTEXTS
+
+  my $png = Tk::PNG::Context->new;
+  foreach my $file (@icons)
+   {
+    $png->read($image, -file => $file);
+    $png->write($image, "$file.new", -format => 'png -compression 9');
+   }
+  $png->read($image, -data => $png_data, -to => [$x, $y]);
+  my $base64 = $png->data($image);
+
+Reading or writing a PNG image through the photo sets up libpng and
+zlib afresh each time, which for an icon costs more than decoding it. A
+Tk::PNG::Context keeps that memory from one image to the next, so a job
+converting many small images allocates next to nothing after the first.
+C<read> loads the whole of a file or of PNG data, as given to C<-data>,
+into the photo; C<write> and C<data> save the whole photo like the
+photo's own methods. C<-format> takes the same options as the photo
+does. A context is not shared between threads: each thread creates its
+own.
+
+=head1 IMAGE INFORMATION
+
+  my $info = Tk::PNG::info('something.png');
+  my $info = Tk::PNG::info($png_data);
+  print "$info->{width}x$info->{height}\n";
+
+C<Tk::PNG::info> returns a hash reference describing a PNG file, or PNG
+data held in a string, without decoding the image. Only the chunk
+headers are read; the image data is skipped over, so this is cheap even
+for very large files. The hash holds C<width>, C<height>, C<bit_depth>,
+C<color_type> and C<interlace> from the IHDR chunk, and, when the file
+has the corresponding chunks, C<gamma>, C<srgb> (the rendering intent),
+C<phys> (C<[$x, $y, $unit]> pixels per unit), C<time> (as
+C<"YYYY-MM-DD HH:MM:SS">) and C<text> (the keywords of the tEXt and zTXt
+chunks, in file order). It dies if the source is not PNG.
+
 
 =head1 AUTHOR
 
@@ -18,6 +18,8 @@
 #include <tkGlue.h>
 #include <tkGlue.m>
 
+#include "imgPNG.h"
+
 extern Tk_PhotoImageFormat	imgFmtPNG;
 
 DECLARE_VTABLES;
@@ -35,3 +37,182 @@ BOOT:
   ImgintVptr  =   (ImgintVtab *) SvIV(FindTkVarName("ImgintVtab",5));    \
   Tk_CreatePhotoImageFormat(&imgFmtPNG);
  }
+
+IV
+_progressive(photo, destX = 0, destY = 0)
+SV *	photo
+int	destX
+int	destY
+CODE:
+ {
+  Lang_CmdInfo *info = WindowCommand(photo, NULL, 1);
+  ProgressivePNG *progPtr;
+  progPtr = CreateProgressivePNG(info->interp, Tcl_GetString(photo),
+                                 destX, destY);
+  if (!progPtr)
+   croak("Cannot create PNG decoder");
+  RETVAL = PTR2IV(progPtr);
+ }
+OUTPUT:
+ RETVAL
+
+int
+_feed(photo, decoder, data)
+SV *	photo
+IV	decoder
+SV *	data
+CODE:
+ {
+  Lang_CmdInfo *info = WindowCommand(photo, NULL, 1);
+  ProgressivePNG *progPtr = INT2PTR(ProgressivePNG *, decoder);
+  STRLEN len;
+  unsigned char *bytes = (unsigned char *) SvPV(data, len);
+  Tcl_ResetResult(info->interp);
+  if (FeedProgressivePNG(info->interp, progPtr, bytes, (int) len) != TCL_OK)
+   croak("%s", Tcl_GetStringResult(info->interp));
+  RETVAL = FinishedProgressivePNG(progPtr);
+ }
+OUTPUT:
+ RETVAL
+
+void
+_progressive_free(decoder)
+IV	decoder
+CODE:
+ {
+  DeleteProgressivePNG(INT2PTR(ProgressivePNG *, decoder));
+ }
+
+IV
+_context()
+CODE:
+ {
+  RETVAL = PTR2IV(CreateContextPNG());
+ }
+OUTPUT:
+ RETVAL
+
+void
+_context_read(photo, context, file, data, format, destX = 0, destY = 0)
+SV *	photo
+IV	context
+SV *	file
+SV *	data
+SV *	format
+int	destX
+int	destY
+CODE:
+ {
+  Lang_CmdInfo *info = WindowCommand(photo, NULL, 1);
+  Tcl_ResetResult(info->interp);
+  if (ContextReadPNG(info->interp, INT2PTR(PNGContext *, context),
+                     Tcl_GetString(photo),
+                     SvOK(file) ? SvPV_nolen(file) : NULL,
+                     data, format, destX, destY) != TCL_OK)
+   croak("%s", Tcl_GetStringResult(info->interp));
+ }
+
+void
+_context_write(photo, context, file, format)
+SV *	photo
+IV	context
+char *	file
+SV *	format
+CODE:
+ {
+  Lang_CmdInfo *info = WindowCommand(photo, NULL, 1);
+  Tcl_ResetResult(info->interp);
+  if (ContextWritePNG(info->interp, INT2PTR(PNGContext *, context),
+                      Tcl_GetString(photo), file, NULL, format) != TCL_OK)
+   croak("%s", Tcl_GetStringResult(info->interp));
+ }
+
+SV *
+_context_data(photo, context, format)
+SV *	photo
+IV	context
+SV *	format
+CODE:
+ {
+  Lang_CmdInfo *info = WindowCommand(photo, NULL, 1);
+  Tcl_DString data;
+  Tcl_DStringInit(&data);
+  Tcl_ResetResult(info->interp);
+  if (ContextWritePNG(info->interp, INT2PTR(PNGContext *, context),
+                      Tcl_GetString(photo), NULL, &data, format) != TCL_OK)
+   {
+    Tcl_DStringFree(&data);
+    croak("%s", Tcl_GetStringResult(info->interp));
+   }
+  RETVAL = newSVpv(Tcl_DStringValue(&data), Tcl_DStringLength(&data));
+  Tcl_DStringFree(&data);
+ }
+OUTPUT:
+ RETVAL
+
+void
+_context_free(context)
+IV	context
+CODE:
+ {
+  DeleteContextPNG(INT2PTR(PNGContext *, context));
+ }
+
+SV *
+info(source)
+SV *	source
+CODE:
+ {
+  STRLEN len;
+  unsigned char *bytes = (unsigned char *) SvPV(source, len);
+  HV *hv = newHV();
+  PNGInfo info;
+  CONST char *error;
+  if (len >= 8 && memcmp(bytes, "\211PNG\r\n\032\n", 8) == 0)
+   error = InfoPNG(NULL, bytes, (int) len, &info);
+  else
+   error = InfoPNG((char *) bytes, NULL, 0, &info);
+  if (error)
+   {
+    FreeInfoPNG(&info);
+    SvREFCNT_dec((SV *) hv);
+    croak("%s", error);
+   }
+  hv_store(hv, "width", 5, newSVuv(info.width), 0);
+  hv_store(hv, "height", 6, newSVuv(info.height), 0);
+  hv_store(hv, "bit_depth", 9, newSViv(info.bitDepth), 0);
+  hv_store(hv, "color_type", 10, newSViv(info.colorType), 0);
+  hv_store(hv, "interlace", 9, newSViv(info.interlace), 0);
+  if (info.valid & PNGINFO_GAMMA)
+   hv_store(hv, "gamma", 5, newSVnv(info.gamma), 0);
+  if (info.valid & PNGINFO_SRGB)
+   hv_store(hv, "srgb", 4, newSViv(info.srgbIntent), 0);
+  if (info.valid & PNGINFO_PHYS)
+   {
+    AV *av = newAV();
+    av_push(av, newSVuv(info.physX));
+    av_push(av, newSVuv(info.physY));
+    av_push(av, newSViv(info.physUnit));
+    hv_store(hv, "phys", 4, newRV_noinc((SV *) av), 0);
+   }
+  if (info.valid & PNGINFO_TIME)
+   hv_store(hv, "time", 4, newSVpvf("%04d-%02d-%02d %02d:%02d:%02d",
+            info.year, info.month, info.day,
+            info.hour, info.minute, info.second), 0);
+  if (info.numText)
+   {
+    AV *av = newAV();
+    char *key = info.textKeys;
+    int i;
+    for (i = 0; i < info.numText; i++)
+     {
+      av_push(av, newSVpv(key, 0));
+      key += strlen(key) + 1;
+     }
+    hv_store(hv, "text", 4, newRV_noinc((SV *) av), 0);
+   }
+  FreeInfoPNG(&info);
+  RETVAL = newRV_noinc((SV *) hv);
+ }
+OUTPUT:
+ RETVAL
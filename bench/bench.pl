@@ -0,0 +1,119 @@
+#!perl
+#
+# bench.pl [-t seconds] directory
+#
+# Times the Tk::PNG path on the PNG files in directory, normally those
+# pngbench -o saved there: a Photo made with -file ("tk-file") and with
+# -data ("tk-data"), and the photo saved with ->write ("tk-write") and
+# ->data ("tk-dataout"). The lines printed have the same fields as
+# those of pngbench, raw_bytes being the size of the file's unfiltered
+# image data and png_bytes the size of the file read or written.
+
+use strict;
+use Time::HiRes qw(time);
+use MIME::Base64;
+use Tk;
+use Tk::PNG;
+
+my $min_time = 0.5;
+if (@ARGV && $ARGV[0] eq '-t')
+ {
+  shift;
+  $min_time = shift;
+ }
+my $dir = shift || die "usage: bench.pl [-t seconds] directory\n";
+my @files = sort glob("$dir/*.png");
+die "No PNG files in $dir\n" unless @files;
+
+my $mw = eval { MainWindow->new };
+unless ($mw)
+ {
+  warn "bench.pl: no display, Tk::PNG not timed\n";
+  exit 0;
+ }
+$mw->withdraw;
+
+my %channels = (0 => 1, 2 => 3, 3 => 1, 4 => 2, 6 => 4);
+my $out = "$dir/bench-out.tmp";
+
+# Linux restarts the count behind VmHWM when 5 goes to clear_refs;
+# elsewhere there is no peak to report.
+sub reset_peak
+{
+ if (open(my $fh, '>', '/proc/self/clear_refs'))
+  {
+   print $fh "5";
+   close($fh);
+  }
+}
+
+sub peak_rss
+{
+ my $peak = -1;
+ if (open(my $fh, '<', '/proc/self/status'))
+  {
+   while (<$fh>)
+    {
+     $peak = $1 if /^VmHWM:\s*(\d+)/;
+    }
+   close($fh);
+  }
+ return $peak;
+}
+
+sub run
+{
+ my ($phase,$name,$info,$png_bytes,$code) = @_;
+ my $raw = int(($info->{width} * $channels{$info->{color_type}} *
+                $info->{bit_depth} + 7) / 8) * $info->{height};
+ reset_peak();
+ my $start = time;
+ my $reps = 0;
+ my $elapsed;
+ do
+  {
+   $code->();
+   $reps++;
+   $elapsed = time - $start;
+  } while ($elapsed < $min_time);
+ my $peak = peak_rss();
+ my $seconds = $elapsed / $reps;
+ $png_bytes = $png_bytes->() if ref $png_bytes;
+ printf "%s\t%s\t%d\t%d\t%d\t%d\t%d\t%.6f\t%.2f\t%.2f\t%d\n",
+        $phase, $name, $info->{width}, $info->{height}, $raw, $png_bytes,
+        $reps, $seconds, $raw / $seconds / 1e6,
+        $seconds * 1e9 / ($info->{width} * $info->{height}), $peak;
+}
+
+$| = 1;
+print "# phase\timage\twidth\theight\traw_bytes\tpng_bytes\treps\t",
+      "seconds\tMB/s\tns/pixel\tpeak_rss_kb\n";
+foreach my $file (@files)
+ {
+  my ($name) = $file =~ m#([^/]+)\.png$#;
+  open(my $fh, '<', $file) || die "Cannot open $file:$!";
+  binmode($fh);
+  my $data = do { local $/; <$fh> };
+  close($fh);
+  my $base64 = encode_base64($data);
+  my $info = Tk::PNG::info($data);
+
+  run('tk-file', $name, $info, length($data), sub {
+   $mw->Photo(-format => 'png', -file => $file)->delete;
+  });
+  run('tk-data', $name, $info, length($data), sub {
+   $mw->Photo(-format => 'png', -data => $base64)->delete;
+  });
+
+  my $img = $mw->Photo(-format => 'png', -file => $file);
+  run('tk-write', $name, $info, sub { -s $out }, sub {
+   $img->write($out, -format => 'png');
+  });
+  my $saved = '';
+  run('tk-dataout', $name, $info, sub { length(decode_base64($saved)) }, sub {
+   $saved = $img->data(-format => 'png');
+  });
+  $img->delete;
+  unlink($out);
+ }
+$mw->destroy;
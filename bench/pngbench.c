@@ -0,0 +1,446 @@
+/*
+ * pngbench.c --
+ *
+ * Times libpng itself on a set of generated images, the way pngtest's
+ * PNGTEST_TIMING does for pngtest.png, and optionally saves the images
+ * for bench.pl, which times the same files through Tk::PNG.
+ *
+ *	pngbench [-t seconds] [-o directory] [image ...]
+ *
+ * Each image is written ("write" phase) and read back ("read" phase)
+ * as often as fits in the given time (default 0.5 seconds). One line of
+ * tab separated fields is printed per phase and image:
+ *
+ *	phase image width height raw_bytes png_bytes reps seconds
+ *	MB/s ns/pixel peak_rss_kb
+ *
+ * raw_bytes is the size of the unfiltered image data, on which MB/s is
+ * based; seconds is the time of one repetition, and peak_rss_kb the
+ * highest resident size during the phase (or of the whole run where
+ * the system can't tell).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "png.h"
+
+#ifndef png_jmpbuf
+#define png_jmpbuf(png_ptr) (*(jmp_buf *) (png_ptr))
+#endif
+
+typedef struct BenchImage {
+    char *name;
+    int width, height;
+    int colorType, bitDepth;
+    int interlace;
+    int filters;		/* png_set_filter mask, or 0 for libpng's
+				 * own choice */
+} BenchImage;
+
+static BenchImage images[] = {
+    {"gray1",		1024, 1024, PNG_COLOR_TYPE_GRAY, 1,
+	PNG_INTERLACE_NONE, 0},
+    {"palette4",	1024, 1024, PNG_COLOR_TYPE_PALETTE, 4,
+	PNG_INTERLACE_NONE, 0},
+    {"palette8-adam7",	1024, 1024, PNG_COLOR_TYPE_PALETTE, 8,
+	PNG_INTERLACE_ADAM7, 0},
+    {"gray8-paeth",	1024, 1024, PNG_COLOR_TYPE_GRAY, 8,
+	PNG_INTERLACE_NONE, PNG_FILTER_PAETH},
+    {"gray16-adam7",	1024, 1024, PNG_COLOR_TYPE_GRAY, 16,
+	PNG_INTERLACE_ADAM7, 0},
+    {"grayalpha8",	1024, 1024, PNG_COLOR_TYPE_GRAY_ALPHA, 8,
+	PNG_INTERLACE_NONE, 0},
+    {"rgb8-small",	64, 64, PNG_COLOR_TYPE_RGB, 8,
+	PNG_INTERLACE_NONE, 0},
+    {"rgb8",		1024, 1024, PNG_COLOR_TYPE_RGB, 8,
+	PNG_INTERLACE_NONE, 0},
+    {"rgb8-none",	1024, 1024, PNG_COLOR_TYPE_RGB, 8,
+	PNG_INTERLACE_NONE, PNG_FILTER_NONE},
+    {"rgb8-sub",	1024, 1024, PNG_COLOR_TYPE_RGB, 8,
+	PNG_INTERLACE_NONE, PNG_FILTER_SUB},
+    {"rgb8-adam7",	1024, 1024, PNG_COLOR_TYPE_RGB, 8,
+	PNG_INTERLACE_ADAM7, 0},
+    {"rgb16",		1024, 1024, PNG_COLOR_TYPE_RGB, 16,
+	PNG_INTERLACE_NONE, 0},
+    {"rgba8-large",	2048, 2048, PNG_COLOR_TYPE_RGB_ALPHA, 8,
+	PNG_INTERLACE_NONE, 0},
+    {"rgba8-large-adam7", 2048, 2048, PNG_COLOR_TYPE_RGB_ALPHA, 8,
+	PNG_INTERLACE_ADAM7, 0},
+    {"rgba16",		1024, 1024, PNG_COLOR_TYPE_RGB_ALPHA, 16,
+	PNG_INTERLACE_NONE, 0},
+    {NULL}
+};
+
+/*
+ * Memory the encoder writes to and the decoder reads from.
+ */
+
+typedef struct MemBuffer {
+    png_bytep data;
+    png_size_t length, size, pos;
+} MemBuffer;
+
+static void	MemWrite PNGARG((png_structp png_ptr, png_bytep data,
+		    png_size_t length));
+static void	MemFlush PNGARG((png_structp png_ptr));
+static void	MemRead PNGARG((png_structp png_ptr, png_bytep data,
+		    png_size_t length));
+static double	Now PNGARG((void));
+static void	ResetPeak PNGARG((void));
+static long	PeakRSS PNGARG((void));
+static int	Channels PNGARG((BenchImage *imagePtr));
+static png_bytepp MakeRows PNGARG((BenchImage *imagePtr,
+		    png_size_t rowbytes));
+static void	WriteImage PNGARG((BenchImage *imagePtr, png_bytepp rows,
+		    MemBuffer *bufPtr));
+static void	ReadImage PNGARG((MemBuffer *bufPtr, png_bytepp rows));
+static void	Report PNGARG((char *phase, BenchImage *imagePtr,
+		    png_size_t rawBytes, png_size_t pngBytes, int reps,
+		    double seconds, long peak));
+
+static void
+MemWrite(png_ptr, data, length)
+    png_structp png_ptr;
+    png_bytep data;
+    png_size_t length;
+{
+    MemBuffer *bufPtr = (MemBuffer *) png_get_io_ptr(png_ptr);
+
+    if (bufPtr->length + length > bufPtr->size) {
+	png_size_t size = bufPtr->size ? bufPtr->size : 65536;
+
+	while (size < bufPtr->length + length) {
+	    size *= 2;
+	}
+	bufPtr->data = (png_bytep) realloc(bufPtr->data, size);
+	if (bufPtr->data == NULL) {
+	    png_error(png_ptr, "out of memory");
+	}
+	bufPtr->size = size;
+    }
+    memcpy(bufPtr->data + bufPtr->length, data, length);
+    bufPtr->length += length;
+}
+
+static void
+MemFlush(png_ptr)
+    png_structp png_ptr;
+{
+}
+
+static void
+MemRead(png_ptr, data, length)
+    png_structp png_ptr;
+    png_bytep data;
+    png_size_t length;
+{
+    MemBuffer *bufPtr = (MemBuffer *) png_get_io_ptr(png_ptr);
+
+    if (bufPtr->pos + length > bufPtr->length) {
+	png_error(png_ptr, "read past end of data");
+    }
+    memcpy(data, bufPtr->data + bufPtr->pos, length);
+    bufPtr->pos += length;
+}
+
+static double
+Now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * Linux keeps the peak resident size in VmHWM of /proc/self/status,
+ * and lets a process restart it by writing 5 to /proc/self/clear_refs.
+ * Elsewhere the peak of the whole run is all there is.
+ */
+
+static void
+ResetPeak()
+{
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+
+    if (f != NULL) {
+	fputs("5", f);
+	fclose(f);
+    }
+}
+
+static long
+PeakRSS()
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+    long peak = -1;
+    struct rusage usage;
+
+    if (f != NULL) {
+	while (fgets(line, sizeof(line), f) != NULL) {
+	    if (strncmp(line, "VmHWM:", 6) == 0) {
+		peak = atol(line + 6);
+		break;
+	    }
+	}
+	fclose(f);
+    }
+    if (peak < 0) {
+	getrusage(RUSAGE_SELF, &usage);
+	peak = usage.ru_maxrss;
+    }
+    return peak;
+}
+
+static int
+Channels(imagePtr)
+    BenchImage *imagePtr;
+{
+    switch (imagePtr->colorType) {
+	case PNG_COLOR_TYPE_GRAY_ALPHA:
+	    return 2;
+	case PNG_COLOR_TYPE_RGB:
+	    return 3;
+	case PNG_COLOR_TYPE_RGB_ALPHA:
+	    return 4;
+	default:
+	    return 1;
+    }
+}
+
+/*
+ * Make the rows of an image: smooth gradients with a little noise, so
+ * that the filters have something to do and the data neither vanishes
+ * in the compressor nor is incompressible. Palette images get blocks
+ * of colours, and alpha a diagonal ramp.
+ */
+
+static png_bytepp
+MakeRows(imagePtr, rowbytes)
+    BenchImage *imagePtr;
+    png_size_t rowbytes;
+{
+    int channels = Channels(imagePtr);
+    int depth = imagePtr->bitDepth;
+    int maxValue = (depth == 16) ? 65535 : (1 << depth) - 1;
+    unsigned long seed = 12345;
+    png_bytepp rows;
+    png_bytep p;
+    int x, y, c, v, bit;
+
+    rows = (png_bytepp) malloc(imagePtr->height * sizeof(png_bytep));
+    for (y = 0; y < imagePtr->height; y++) {
+	rows[y] = p = (png_bytep) calloc(1, rowbytes);
+	bit = 8;
+	for (x = 0; x < imagePtr->width; x++) {
+	    for (c = 0; c < channels; c++) {
+		seed = seed * 1103515245 + 12345;
+		if (imagePtr->colorType == PNG_COLOR_TYPE_PALETTE) {
+		    v = (x / 32) + (y / 32) * 7 + ((seed >> 16) % 3 == 0);
+		} else if ((c == channels - 1)
+			&& (imagePtr->colorType & PNG_COLOR_MASK_ALPHA)) {
+		    v = (x + y) * maxValue / (imagePtr->width
+			    + imagePtr->height);
+		} else if (depth < 8) {
+		    v = ((x / 16) ^ (y / 16)) + ((seed >> 16) % 16 == 0);
+		} else {
+		    v = (x * (c + 1) + y * (3 - c)) * (maxValue / 255 + 1) / 4
+			    + (int) ((seed >> 16) % 5) * (maxValue / 255 + 1);
+		}
+		v %= maxValue + 1;
+		if (depth == 16) {
+		    *p++ = (png_byte) (v >> 8);
+		    *p++ = (png_byte) v;
+		} else if (depth == 8) {
+		    *p++ = (png_byte) v;
+		} else {
+		    bit -= depth;
+		    *p |= (png_byte) (v << bit);
+		    if (bit == 0) {
+			p++;
+			bit = 8;
+		    }
+		}
+	    }
+	}
+    }
+    return rows;
+}
+
+static void
+WriteImage(imagePtr, rows, bufPtr)
+    BenchImage *imagePtr;
+    png_bytepp rows;
+    MemBuffer *bufPtr;
+{
+    png_structp png_ptr;
+    png_infop info_ptr;
+    png_color palette[256];
+    int i;
+
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+	    NULL);
+    info_ptr = png_create_info_struct(png_ptr);
+    if (setjmp(png_jmpbuf(png_ptr))) {
+	fprintf(stderr, "pngbench: error writing %s\n", imagePtr->name);
+	exit(1);
+    }
+    bufPtr->length = 0;
+    png_set_write_fn(png_ptr, (png_voidp) bufPtr, MemWrite, MemFlush);
+    png_set_IHDR(png_ptr, info_ptr, imagePtr->width, imagePtr->height,
+	    imagePtr->bitDepth, imagePtr->colorType, imagePtr->interlace,
+	    PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+    if (imagePtr->colorType == PNG_COLOR_TYPE_PALETTE) {
+	for (i = 0; i < (1 << imagePtr->bitDepth); i++) {
+	    palette[i].red = (png_byte) (i * 37);
+	    palette[i].green = (png_byte) (i * 101);
+	    palette[i].blue = (png_byte) (255 - i);
+	}
+	png_set_PLTE(png_ptr, info_ptr, palette, 1 << imagePtr->bitDepth);
+    }
+    if (imagePtr->filters) {
+	png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, imagePtr->filters);
+    }
+    png_write_info(png_ptr, info_ptr);
+    png_write_image(png_ptr, rows);
+    png_write_end(png_ptr, NULL);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+}
+
+static void
+ReadImage(bufPtr, rows)
+    MemBuffer *bufPtr;
+    png_bytepp rows;
+{
+    png_structp png_ptr;
+    png_infop info_ptr;
+
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+	    NULL);
+    info_ptr = png_create_info_struct(png_ptr);
+    if (setjmp(png_jmpbuf(png_ptr))) {
+	fprintf(stderr, "pngbench: error reading image\n");
+	exit(1);
+    }
+    bufPtr->pos = 0;
+    png_set_read_fn(png_ptr, (png_voidp) bufPtr, MemRead);
+    png_read_info(png_ptr, info_ptr);
+    png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
+    png_read_image(png_ptr, rows);
+    png_read_end(png_ptr, NULL);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+}
+
+static void
+Report(phase, imagePtr, rawBytes, pngBytes, reps, seconds, peak)
+    char *phase;
+    BenchImage *imagePtr;
+    png_size_t rawBytes, pngBytes;
+    int reps;
+    double seconds;
+    long peak;
+{
+    printf("%s\t%s\t%d\t%d\t%lu\t%lu\t%d\t%.6f\t%.2f\t%.2f\t%ld\n",
+	    phase, imagePtr->name, imagePtr->width, imagePtr->height,
+	    (unsigned long) rawBytes, (unsigned long) pngBytes, reps,
+	    seconds, rawBytes / seconds / 1e6,
+	    seconds * 1e9 / ((double) imagePtr->width * imagePtr->height),
+	    peak);
+    fflush(stdout);
+}
+
+int
+main(argc, argv)
+    int argc;
+    char **argv;
+{
+    double minTime = 0.5, start, elapsed;
+    char *outDir = NULL;
+    BenchImage *imagePtr;
+    MemBuffer buf;
+    png_bytepp rows;
+    png_size_t rowbytes;
+    long peak;
+    int i, y, reps, selected;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+	if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc)) {
+	    minTime = atof(argv[++i]);
+	} else if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+	    outDir = argv[++i];
+	} else {
+	    fprintf(stderr,
+		    "usage: pngbench [-t seconds] [-o directory] [image ...]\n");
+	    return 2;
+	}
+    }
+
+    printf("# phase\timage\twidth\theight\traw_bytes\tpng_bytes\treps\t"
+	    "seconds\tMB/s\tns/pixel\tpeak_rss_kb\n");
+    memset((void *) &buf, 0, sizeof(buf));
+    for (imagePtr = images; imagePtr->name != NULL; imagePtr++) {
+	if (i < argc) {
+	    int j;
+
+	    for (selected = 0, j = i; j < argc; j++) {
+		selected |= (strcmp(argv[j], imagePtr->name) == 0);
+	    }
+	    if (!selected) {
+		continue;
+	    }
+	}
+	rowbytes = ((png_size_t) imagePtr->width * Channels(imagePtr)
+		* imagePtr->bitDepth + 7) / 8;
+	rows = MakeRows(imagePtr, rowbytes);
+
+	ResetPeak();
+	start = Now();
+	reps = 0;
+	do {
+	    WriteImage(imagePtr, rows, &buf);
+	    reps++;
+	    elapsed = Now() - start;
+	} while (elapsed < minTime);
+	peak = PeakRSS();
+	Report("write", imagePtr, rowbytes * imagePtr->height, buf.length,
+		reps, elapsed / reps, peak);
+
+	if (outDir != NULL) {
+	    char path[1024];
+	    FILE *f;
+
+	    sprintf(path, "%.900s/%s.png", outDir, imagePtr->name);
+	    if ((f = fopen(path, "wb")) == NULL
+		    || fwrite(buf.data, 1, buf.length, f) != buf.length
+		    || fclose(f) != 0) {
+		fprintf(stderr, "pngbench: can't write %s\n", path);
+		return 1;
+	    }
+	}
+
+	ResetPeak();
+	start = Now();
+	reps = 0;
+	do {
+	    ReadImage(&buf, rows);
+	    reps++;
+	    elapsed = Now() - start;
+	} while (elapsed < minTime);
+	peak = PeakRSS();
+	Report("read", imagePtr, rowbytes * imagePtr->height, buf.length,
+		reps, elapsed / reps, peak);
+
+	for (y = 0; y < imagePtr->height; y++) {
+	    free(rows[y]);
+	}
+	free(rows);
+    }
+    free(buf.data);
+    return 0;
+}
@@ -15,6 +15,18 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "pTk/imgInt.h"
 #include <pTk/tkImgPhoto.h>
@@ -31,6 +43,9 @@
 #   include "png.h"
 #endif
 #endif
+#include <zlib.h>
+
+#include "imgPNG.h"
 
 #ifdef __WIN32__
 #define PNG_LIB_NAME "png_dll"
@@ -42,6 +57,27 @@
 
 #define COMPRESS_THRESHOLD 1024
 
+/*
+ * The pass and row libpng's next png_read_row is for. The png_struct
+ * became opaque in libpng 1.5, which added functions to get them.
+ */
+
+#if PNG_LIBPNG_VER >= 10500
+#define CurrentPassPNG(png_ptr) ((int) png_get_current_pass_number(png_ptr))
+#define CurrentRowPNG(png_ptr) ((int) png_get_current_row_number(png_ptr))
+#else
+#define CurrentPassPNG(png_ptr) ((int) (png_ptr)->pass)
+#define CurrentRowPNG(png_ptr) ((int) (png_ptr)->row_number)
+#endif
+
+/*
+ * Non-interlaced images are decoded in bands of at most this many
+ * bytes, each band being handed to the photo image as soon as it is
+ * complete. Interlaced images still need a buffer for the whole image.
+ */
+
+#define BAND_SIZE 262144
+
 /*
  * The format record for the PNG file format:
  */
@@ -73,6 +109,153 @@ Tk_PhotoImageFormat imgFmtPNG = {
     StringWritePNG,	/* stringWriteProc */
 };
 
+/*
+ * Options that may follow "png" in the format of a read:
+ */
+
+static CONST char *readOptionStrings[] = {
+    "-buffersize", "-crc", "-gamma", "-passes", "-samples16", "-scale",
+    (char *) NULL
+};
+
+enum readOptions {
+    ROPT_BUFFERSIZE, ROPT_CRC, ROPT_GAMMA, ROPT_PASSES, ROPT_SAMPLES16,
+    ROPT_SCALE
+};
+
+/*
+ * Values of -crc. "ignore" is for trusted input: the checksums of the
+ * critical chunks, IDAT among them, are then neither computed nor
+ * checked.
+ */
+
+static CONST char *crcStrings[] = {
+    "check", "ignore", (char *) NULL
+};
+
+typedef struct ReadOptions {
+    int ignoreCrc;		/* Skip the CRC of critical chunks */
+    int bufferSize;		/* zlib buffer size, or 0 for libpng's */
+    double gamma;		/* Display gamma, or 0 for no correction */
+    int scale;			/* Keep every scale'th row and column */
+    int passes;			/* Adam7 passes to decode, 1 to 7 */
+    Tcl_Obj *samples16;		/* Variable for the 16-bit samples, or NULL */
+} ReadOptions;
+
+/*
+ * Gamma correction is left out when the file and display gammas cancel
+ * to within this much, as libpng itself does.
+ */
+
+#define GAMMA_THRESHOLD 0.05
+
+/*
+ * Where the pixels of each Adam7 pass lie: pass p holds the pixels
+ * (xStart[p] + i * xInc[p], yStart[p] + j * yInc[p]). A non-interlaced
+ * image is read as the single pass (0, 1, 0, 1).
+ */
+
+static int adam7XStart[] = {0, 4, 0, 2, 0, 1, 0};
+static int adam7XInc[]   = {8, 8, 4, 4, 2, 2, 1};
+static int adam7YStart[] = {0, 0, 4, 0, 2, 0, 1};
+static int adam7YInc[]   = {8, 8, 8, 4, 4, 2, 2};
+
+/*
+ * Options that may follow "png" in the format of a write:
+ */
+
+static CONST char *writeOptionStrings[] = {
+    "-buffersize", "-compression", "-filter", "-interlace", "-memlevel",
+    "-strategy", "-threads", "-windowbits", (char *) NULL
+};
+
+enum writeOptions {
+    WOPT_BUFFERSIZE, WOPT_COMPRESSION, WOPT_FILTER, WOPT_INTERLACE,
+    WOPT_MEMLEVEL, WOPT_STRATEGY, WOPT_THREADS, WOPT_WINDOWBITS
+};
+
+/*
+ * Symbolic values of -compression and -strategy. "fast" is meant for
+ * scratch files and screenshots: the lowest level, with run-length
+ * matching only where zlib supports it.
+ */
+
+static CONST char *compressionStrings[] = {
+    "default", "fast", "max", (char *) NULL
+};
+
+static CONST char *strategyStrings[] = {
+    "default", "filtered", "huffman",
+#ifdef Z_RLE
+    "rle",
+#endif
+    (char *) NULL
+};
+
+static int strategyValues[] = {
+    Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY,
+#ifdef Z_RLE
+    Z_RLE,
+#endif
+};
+
+/*
+ * Values of -filter. "all" lets libpng try every filter on every row,
+ * "auto" picks a single filter for the whole image from a few rows.
+ */
+
+static CONST char *filterStrings[] = {
+    "none", "sub", "up", "avg", "paeth", "all", "auto", (char *) NULL
+};
+
+static int filterValues[] = {
+    PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG,
+    PNG_FILTER_PAETH, PNG_ALL_FILTERS, 0
+};
+
+#define FILTER_AUTO 6
+
+/*
+ * Number of rows ChooseFilterPNG looks at.
+ */
+
+#define FILTER_SAMPLE_ROWS 16
+
+#ifdef Z_RLE
+#define FAST_STRATEGY Z_RLE
+#else
+#define FAST_STRATEGY Z_HUFFMAN_ONLY
+#endif
+
+typedef struct WriteOptions {
+    int interlace;		/* PNG_INTERLACE_NONE or PNG_INTERLACE_ADAM7 */
+    int level;			/* zlib parameters, or -1 to let libpng */
+    int strategy;		/* choose */
+    int memLevel;
+    int windowBits;
+    int filter;			/* Index in filterStrings, or -1 */
+    int bufferSize;		/* Size of each IDAT chunk, 0 for libpng's */
+    int tags;			/* Number of text chunks to write */
+    int endOptions;		/* Index of "--", after which every pair
+				 * is a text chunk, or objc */
+    int threads;		/* Threads compressing the image data */
+} WriteOptions;
+
+/*
+ * Limits of -buffersize. libpng's own default is 8192 bytes.
+ */
+
+#define MIN_BUFFER_SIZE 1024
+#define MAX_BUFFER_SIZE 16777216
+
+/*
+ * With -threads the filtered image data is compressed in independent
+ * pieces of this many bytes, each primed with the 32K that precede it.
+ */
+
+#define DEFLATE_JOB_SIZE 131072
+#define MAX_THREADS 256
+
 /*
  * Prototypes for local procedures defined in this file:
  */
@@ -82,12 +265,106 @@ static int CommonMatchPNG _ANSI_ARGS_((MFile *handle, int *widthPtr,
 static int CommonReadPNG _ANSI_ARGS_((png_structp png_ptr, Tcl_Obj *format,
 	Tk_PhotoHandle imageHandle, int destX, int destY, int width,
 	int height, int srcX, int srcY));
+static int ParseReadOptions _ANSI_ARGS_((Tcl_Interp *interp,
+	Tcl_Obj *format, ReadOptions *optPtr));
+static int GetBufferSize _ANSI_ARGS_((Tcl_Interp *interp,
+	Tcl_Obj *objPtr, int *sizePtr));
+static void ReadScaledPNG _ANSI_ARGS_((png_structp png_ptr,
+	Tk_PhotoHandle imageHandle, Tk_PhotoImageBlock *blockPtr, int scale,
+	int interlaced, int imageWidth, int imageHeight, int destX, int destY,
+	int width, int height, int srcX, int srcY));
+static int FirstSample _ANSI_ARGS_((int start, int inc, int scale,
+	int limit));
+static void SetupReadPNG _ANSI_ARGS_((png_structp png_ptr, png_infop info_ptr,
+	Tk_PhotoImageBlock *blockPtr, double gamma, int keep16));
+static void SaveSamples _ANSI_ARGS_((char *samples,
+	Tk_PhotoImageBlock *blockPtr, int y));
+static int SetSamplesVar _ANSI_ARGS_((Tcl_Interp *interp, Tcl_Obj *varObj,
+	char **samplesPtr, int size));
+static int ParseWriteOptions _ANSI_ARGS_((Tcl_Interp *interp,
+	Tcl_Obj *format, WriteOptions *optPtr));
+static int ChooseFilterPNG _ANSI_ARGS_((Tk_PhotoImageBlock *blockPtr,
+	int pixelSize));
+#ifdef HAVE_PTHREAD
+static int ParallelWritePNG _ANSI_ARGS_((png_structp png_ptr,
+	Tk_PhotoImageBlock *blockPtr, WriteOptions *optPtr, int pixelSize,
+	int filter));
+#endif
 static int CommonWritePNG _ANSI_ARGS_((Tcl_Interp *interp, png_structp png_ptr,
 	png_infop info_ptr, Tcl_Obj *format,
 	Tk_PhotoImageBlock *blockPtr));
+typedef struct cleanup_info {
+    Tcl_Interp *interp;
+    char **data;
+    char *samples;		/* 16-bit samples kept by -samples16 */
+} cleanup_info;
+
 static void tk_png_error _ANSI_ARGS_((png_structp, png_const_charp));
 static void tk_png_warning _ANSI_ARGS_((png_structp, png_const_charp));
 
+/*
+ * Memory libpng uses while reading or writing one image, see
+ * ArenaAllocPNG.
+ */
+
+typedef union ArenaHeader {
+    struct {
+	size_t size;		/* Bytes of the piece after the header */
+	struct ArenaLarge *large; /* Its record if allocated by itself */
+    } h;
+    double align;
+} ArenaHeader;
+
+typedef struct ArenaLarge {
+    struct ArenaLarge *prev, *next;
+    ArenaHeader header;		/* Followed by the piece */
+} ArenaLarge;
+
+typedef union ArenaBlock {
+    union ArenaBlock *next;
+    ArenaHeader align;		/* Keeps the pieces aligned like it */
+} ArenaBlock;
+
+typedef struct PNGArena {
+    ArenaBlock *blocks;		/* The current block comes first */
+    char *next, *end;		/* Unused part of the current block */
+    ArenaLarge *large;
+    int keep;			/* Keep freed large pieces for reuse */
+    int numSpares;
+    ArenaLarge *spares;		/* Freed large pieces, if keep is set */
+} PNGArena;
+
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_MAX_SPARES 8
+
+static void	InitArenaPNG _ANSI_ARGS_((PNGArena *arenaPtr, int keep));
+static png_structp CreateReadStructPNG _ANSI_ARGS_((
+	cleanup_info *cleanupPtr, PNGArena *arenaPtr));
+static png_structp CreateWriteStructPNG _ANSI_ARGS_((
+	cleanup_info *cleanupPtr, PNGArena *arenaPtr));
+#ifdef PNG_USER_MEM_SUPPORTED
+static png_voidp ArenaAllocPNG _ANSI_ARGS_((png_structp png_ptr,
+	png_size_t size));
+static void	ArenaFreePNG _ANSI_ARGS_((png_structp png_ptr,
+		    png_voidp ptr));
+#endif
+static void	ResetArenaPNG _ANSI_ARGS_((PNGArena *arenaPtr));
+static void	FreeArenaPNG _ANSI_ARGS_((PNGArena *arenaPtr));
+#ifdef HAVE_MMAP
+static char *	MapFilePNG _ANSI_ARGS_((Tcl_Interp *interp, char *fileName,
+		    size_t *sizePtr));
+#endif
+static int	ReadPNG _ANSI_ARGS_((Tcl_Interp *interp, MFile *handlePtr,
+		    PNGArena *arenaPtr, Tcl_Obj *format,
+		    Tk_PhotoHandle imageHandle, int destX, int destY,
+		    int width, int height, int srcX, int srcY));
+static int	FileWritePNG _ANSI_ARGS_((Tcl_Interp *interp, char *filename,
+		    PNGArena *arenaPtr, Tcl_Obj *format,
+		    Tk_PhotoImageBlock *blockPtr));
+static int	DataWritePNG _ANSI_ARGS_((Tcl_Interp *interp,
+		    Tcl_DString *dataPtr, PNGArena *arenaPtr, Tcl_Obj *format,
+		    Tk_PhotoImageBlock *blockPtr));
+
 /*
  * These functions are used for all Input/Output.
  */
@@ -97,6 +374,16 @@ static void	tk_png_read _ANSI_ARGS_((png_structp, png_bytep,
 static void	tk_png_write _ANSI_ARGS_((png_structp, png_bytep,
 		    png_size_t));
 
+/*
+ * Callbacks of the progressive reader.
+ */
+
+static void	ProgressiveInfo _ANSI_ARGS_((png_structp, png_infop));
+static void	ProgressiveRow _ANSI_ARGS_((png_structp, png_bytep,
+		    png_uint_32, int));
+static void	ProgressiveEnd _ANSI_ARGS_((png_structp, png_infop));
+static void	FlushProgressivePNG _ANSI_ARGS_((ProgressivePNG *progPtr));
+
 #ifndef _LANG
 
 static struct PngFunctions {
@@ -120,6 +407,9 @@ static struct PngFunctions {
     void (* init_io) _ANSI_ARGS_((png_structp, FILE *));
     void (* read_image) _ANSI_ARGS_((png_structp, png_bytepp));
     void (* read_info) _ANSI_ARGS_((png_structp, png_infop));
+    void (* read_row) _ANSI_ARGS_((png_structp, png_bytep, png_bytep));
+    void (* read_rows) _ANSI_ARGS_((png_structp, png_bytepp, png_bytepp,
+	    png_uint_32));
     void (* read_update_info) _ANSI_ARGS_((png_structp, png_infop));
     int (* set_interlace_handling) _ANSI_ARGS_ ((png_structp));
     void (* set_read_fn) _ANSI_ARGS_((png_structp, png_voidp, png_rw_ptr));
@@ -140,6 +430,30 @@ static struct PngFunctions {
     void (* set_gAMA) PNGARG((png_structp png_ptr, png_infop, double));
     void (* set_gamma) _ANSI_ARGS_((png_structp, double, double));
     void (* set_sRGB_gAMA_and_cHRM) _ANSI_ARGS_((png_structp, png_infop, int));
+    void (* set_filter) _ANSI_ARGS_((png_structp, int, int));
+    void (* set_compression_level) _ANSI_ARGS_((png_structp, int));
+    void (* set_compression_strategy) _ANSI_ARGS_((png_structp, int));
+    void (* set_compression_mem_level) _ANSI_ARGS_((png_structp, int));
+    void (* set_compression_window_bits) _ANSI_ARGS_((png_structp, int));
+    void (* set_progressive_read_fn) _ANSI_ARGS_((png_structp, png_voidp,
+	    png_progressive_info_ptr, png_progressive_row_ptr,
+	    png_progressive_end_ptr));
+    void (* process_data) _ANSI_ARGS_((png_structp, png_infop,
+	    png_bytep, png_size_t));
+    void (* progressive_combine_row) _ANSI_ARGS_((png_structp,
+	    png_bytep, png_bytep));
+    void (* set_crc_action) _ANSI_ARGS_((png_structp, int, int));
+    void (* set_compression_buffer_size) _ANSI_ARGS_((png_structp,
+	    png_uint_32));
+    void (* write_chunk) _ANSI_ARGS_((png_structp, png_bytep, png_bytep,
+	    png_size_t));
+    png_structp (* create_read_struct_2) _ANSI_ARGS_((png_const_charp,
+	png_voidp, png_error_ptr, png_error_ptr, png_voidp, png_malloc_ptr,
+	png_free_ptr));
+    png_voidp (* get_mem_ptr) _ANSI_ARGS_((png_structp));
+    png_structp (* create_write_struct_2) _ANSI_ARGS_((png_const_charp,
+	png_voidp, png_error_ptr, png_error_ptr, png_voidp, png_malloc_ptr,
+	png_free_ptr));
 } png = {0};
 
 static char *symbols[] = {
@@ -158,6 +472,8 @@ static char *symbols[] = {
     "png_init_io",
     "png_read_image",
     "png_read_info",
+    "png_read_row",
+    "png_read_rows",
     "png_read_update_info",
     "png_set_interlace_handling",
     "png_set_read_fn",
@@ -178,16 +494,25 @@ static char *symbols[] = {
     "png_set_gAMA",
     "png_set_gamma",
     "png_set_sRGB_gAMA_and_cHRM",
+    "png_set_filter",
+    "png_set_compression_level",
+    "png_set_compression_strategy",
+    "png_set_compression_mem_level",
+    "png_set_compression_window_bits",
+    "png_set_progressive_read_fn",
+    "png_process_data",
+    "png_progressive_combine_row",
+    "png_set_crc_action",
+    "png_set_compression_buffer_size",
+    "png_write_chunk",
+    "png_create_read_struct_2",
+    "png_get_mem_ptr",
+    "png_create_write_struct_2",
     (char *) NULL
 };
 
 #endif
 
-typedef struct cleanup_info {
-    Tcl_Interp *interp;
-    char **data;
-} cleanup_info;
-
 static void
 tk_png_error(png_ptr, error_msg)
     png_structp png_ptr;
@@ -199,6 +524,9 @@ tk_png_error(png_ptr, error_msg)
     if (info->data) {
 	ckfree((char *) info->data);
     }
+    if (info->samples) {
+	ckfree(info->samples);
+    }
     Tcl_AppendResult(info->interp,
 	    error_msg,          NULL);
     longjmp(*(jmp_buf *) png_ptr,1);
@@ -236,6 +564,206 @@ tk_png_write(png_ptr, data, length)
     }
 }
 
+/*
+ * Everything libpng allocates while reading or writing one image,
+ * png_struct and zlib's state included, comes from a PNGArena that
+ * lives at least as long as the png_struct: pieces of up to half a
+ * block are cut one after the other from blocks of ARENA_BLOCK_SIZE
+ * bytes, larger ones are allocated by themselves, and FreeArenaPNG
+ * releases it all after png_destroy_read_struct, on errors as well. A
+ * small image thus costs one allocation instead of dozens. Freeing a
+ * piece gives it back only if it was the last one cut from the block,
+ * which covers libpng's short-lived buffers, or if it was allocated by
+ * itself.
+ *
+ * The arena of a PNGContext is set to keep its memory: freed large
+ * pieces, zlib's windows and the row buffers, wait on a list of spares
+ * for the next image, and ResetArenaPNG rewinds the first block instead
+ * of freeing it. The images after the first then cost no allocation at
+ * all, as long as they are not much larger.
+ */
+
+static void
+InitArenaPNG(arenaPtr, keep)
+    PNGArena *arenaPtr;
+    int keep;
+{
+    memset((VOID *) arenaPtr, 0, sizeof(PNGArena));
+    arenaPtr->keep = keep;
+}
+
+static png_structp
+CreateReadStructPNG(cleanupPtr, arenaPtr)
+    cleanup_info *cleanupPtr;
+    PNGArena *arenaPtr;
+{
+#ifdef PNG_USER_MEM_SUPPORTED
+    if ((png_create_read_struct_2 != NULL) && (png_get_mem_ptr != NULL)) {
+	return png_create_read_struct_2(PNG_LIBPNG_VER_STRING,
+		(png_voidp) cleanupPtr, tk_png_error, tk_png_warning,
+		(png_voidp) arenaPtr, ArenaAllocPNG, ArenaFreePNG);
+    }
+#endif
+    return png_create_read_struct(PNG_LIBPNG_VER_STRING,
+	    (png_voidp) cleanupPtr, tk_png_error, tk_png_warning);
+}
+
+static png_structp
+CreateWriteStructPNG(cleanupPtr, arenaPtr)
+    cleanup_info *cleanupPtr;
+    PNGArena *arenaPtr;
+{
+#ifdef PNG_USER_MEM_SUPPORTED
+    if ((png_create_write_struct_2 != NULL) && (png_get_mem_ptr != NULL)) {
+	return png_create_write_struct_2(PNG_LIBPNG_VER_STRING,
+		(png_voidp) cleanupPtr, tk_png_error, tk_png_warning,
+		(png_voidp) arenaPtr, ArenaAllocPNG, ArenaFreePNG);
+    }
+#endif
+    return png_create_write_struct(PNG_LIBPNG_VER_STRING,
+	    (png_voidp) cleanupPtr, tk_png_error, tk_png_warning);
+}
+
+#ifdef PNG_USER_MEM_SUPPORTED
+
+static png_voidp
+ArenaAllocPNG(png_ptr, size)
+    png_structp png_ptr;
+    png_size_t size;
+{
+    PNGArena *arenaPtr = (PNGArena *) png_get_mem_ptr(png_ptr);
+    ArenaHeader *headerPtr;
+    ArenaBlock *blockPtr;
+    ArenaLarge *largePtr;
+
+    size = (size + sizeof(ArenaHeader) - 1)
+	    / sizeof(ArenaHeader) * sizeof(ArenaHeader);
+    if (size > ARENA_BLOCK_SIZE / 2) {
+	ArenaLarge **sparePtr = &arenaPtr->spares;
+
+	while (*sparePtr && (((*sparePtr)->header.h.size < size)
+		|| ((*sparePtr)->header.h.size > 2 * size))) {
+	    sparePtr = &(*sparePtr)->next;
+	}
+	if (*sparePtr) {
+	    largePtr = *sparePtr;
+	    *sparePtr = largePtr->next;
+	    arenaPtr->numSpares--;
+	} else {
+	    largePtr = (ArenaLarge *) ckalloc(sizeof(ArenaLarge) + size);
+	    largePtr->header.h.size = size;
+	    largePtr->header.h.large = largePtr;
+	}
+	largePtr->prev = NULL;
+	largePtr->next = arenaPtr->large;
+	if (largePtr->next) {
+	    largePtr->next->prev = largePtr;
+	}
+	arenaPtr->large = largePtr;
+	return (png_voidp) (largePtr + 1);
+    }
+    if ((size_t) (arenaPtr->end - arenaPtr->next)
+	    < sizeof(ArenaHeader) + size) {
+	blockPtr = (ArenaBlock *) ckalloc(sizeof(ArenaBlock)
+		+ ARENA_BLOCK_SIZE);
+	blockPtr->next = arenaPtr->blocks;
+	arenaPtr->blocks = blockPtr;
+	arenaPtr->next = (char *) (blockPtr + 1);
+	arenaPtr->end = arenaPtr->next + ARENA_BLOCK_SIZE;
+    }
+    headerPtr = (ArenaHeader *) arenaPtr->next;
+    headerPtr->h.size = size;
+    headerPtr->h.large = NULL;
+    arenaPtr->next += sizeof(ArenaHeader) + size;
+    return (png_voidp) (headerPtr + 1);
+}
+
+static void
+ArenaFreePNG(png_ptr, ptr)
+    png_structp png_ptr;
+    png_voidp ptr;
+{
+    PNGArena *arenaPtr = (PNGArena *) png_get_mem_ptr(png_ptr);
+    ArenaHeader *headerPtr = (ArenaHeader *) ptr - 1;
+    ArenaLarge *largePtr = headerPtr->h.large;
+
+    if (largePtr) {
+	if (largePtr->prev) {
+	    largePtr->prev->next = largePtr->next;
+	} else {
+	    arenaPtr->large = largePtr->next;
+	}
+	if (largePtr->next) {
+	    largePtr->next->prev = largePtr->prev;
+	}
+	if (arenaPtr->keep && (arenaPtr->numSpares < ARENA_MAX_SPARES)) {
+	    largePtr->next = arenaPtr->spares;
+	    arenaPtr->spares = largePtr;
+	    arenaPtr->numSpares++;
+	} else {
+	    ckfree((char *) largePtr);
+	}
+    } else if ((char *) ptr + headerPtr->h.size == arenaPtr->next) {
+	arenaPtr->next = (char *) headerPtr;
+    }
+}
+
+#endif /* PNG_USER_MEM_SUPPORTED */
+
+/*
+ * Make the memory of a finished image available to the next one. The
+ * first block and the spares stay, anything libpng didn't free goes.
+ */
+
+static void
+ResetArenaPNG(arenaPtr)
+    PNGArena *arenaPtr;
+{
+    ArenaBlock *blockPtr;
+    ArenaLarge *largePtr;
+
+    if (arenaPtr->blocks) {
+	while (arenaPtr->blocks->next) {
+	    blockPtr = arenaPtr->blocks->next;
+	    arenaPtr->blocks->next = blockPtr->next;
+	    ckfree((char *) blockPtr);
+	}
+	arenaPtr->next = (char *) (arenaPtr->blocks + 1);
+	arenaPtr->end = arenaPtr->next + ARENA_BLOCK_SIZE;
+    }
+    while (arenaPtr->large) {
+	largePtr = arenaPtr->large;
+	arenaPtr->large = largePtr->next;
+	ckfree((char *) largePtr);
+    }
+}
+
+static void
+FreeArenaPNG(arenaPtr)
+    PNGArena *arenaPtr;
+{
+    ArenaBlock *blockPtr;
+    ArenaLarge *largePtr;
+
+    while (arenaPtr->blocks) {
+	blockPtr = arenaPtr->blocks;
+	arenaPtr->blocks = blockPtr->next;
+	ckfree((char *) blockPtr);
+    }
+    while (arenaPtr->large) {
+	largePtr = arenaPtr->large;
+	arenaPtr->large = largePtr->next;
+	ckfree((char *) largePtr);
+    }
+    while (arenaPtr->spares) {
+	largePtr = arenaPtr->spares;
+	arenaPtr->spares = largePtr->next;
+	ckfree((char *) largePtr);
+    }
+    arenaPtr->numSpares = 0;
+    arenaPtr->next = arenaPtr->end = NULL;
+}
+
 static int ChnMatchPNG(interp, chan, fileName, format, widthPtr, heightPtr)
     Tcl_Interp *interp;
     Tcl_Channel chan;
@@ -293,7 +821,7 @@ load_png_library(interp)
     Tcl_Interp *interp;
 {
 #ifndef _LANG
-    if (ImgLoadLib(interp, PNG_LIB_NAME, &png_handle, symbols, 23)
+    if (ImgLoadLib(interp, PNG_LIB_NAME, &png_handle, symbols, 25)
 	    != TCL_OK) {
 	return TCL_ERROR;
     }
@@ -312,12 +840,13 @@ static int ChnReadPNG(interp, chan, fileName, format, imageHandle,
     int width, height;
     int srcX, srcY;
 {
-    png_structp png_ptr;
     MFile handle;
-    cleanup_info cleanup;
-
-    cleanup.interp = interp;
-    cleanup.data = NULL;
+    PNGArena arena;
+    int result;
+#ifdef HAVE_MMAP
+    char *map = NULL;
+    size_t size;
+#endif
 
     if (load_png_library(interp) != TCL_OK) {
 	return TCL_ERROR;
@@ -325,20 +854,82 @@ static int ChnReadPNG(interp, chan, fileName, format, imageHandle,
 
     handle.data = (char *) chan;
     handle.state = IMG_CHAN;
+#ifdef HAVE_MMAP
+    if (fileName) {
+	map = MapFilePNG(interp,
+		Tcl_GetStringFromObj(fileName, (int *) NULL), &size);
+    }
+    if (map) {
+	handle.data = map;
+	handle.length = (int) size;
+	handle.state = IMG_STRING;
+    }
+#endif
 
-    cleanup.interp = interp;
-    cleanup.data = NULL;
+    InitArenaPNG(&arena, 0);
+    result = ReadPNG(interp, &handle, &arena, format, imageHandle,
+	    destX, destY, width, height, srcX, srcY);
+    FreeArenaPNG(&arena);
+#ifdef HAVE_MMAP
+    if (map) {
+	munmap((VOID *) map, size);
+    }
+#endif
+    return result;
+}
 
-    png_ptr=png_create_read_struct(PNG_LIBPNG_VER_STRING,
-	    (png_voidp) &cleanup,tk_png_error,tk_png_warning);
-    if (!png_ptr) return(0);
+#ifdef HAVE_MMAP
 
-    png_set_read_fn(png_ptr, (png_voidp) &handle, tk_png_read);
+/*
+ * A regular file is mapped and then read like -data, by ImgRead copying
+ * from memory, which spares libpng's many small reads of chunk headers,
+ * CRCs and IDAT slices the channel's buffers and system calls. NULL
+ * means the channel should be read instead: the file is a pipe, socket
+ * or device, is empty or too large for an MFile, or can't be opened
+ * again by name.
+ */
 
-    return CommonReadPNG(png_ptr, format, imageHandle, destX, destY,
-	    width, height, srcX, srcY);
+static char *
+MapFilePNG(interp, fileName, sizePtr)
+    Tcl_Interp *interp;
+    char *fileName;
+    size_t *sizePtr;
+{
+    Tcl_DString nameBuffer;
+    char *fullname;
+    struct stat st;
+    VOID *map;
+    int fd;
+
+    fullname = Tcl_TranslateFileName(interp, fileName, &nameBuffer);
+    if (!fullname) {
+	Tcl_ResetResult(interp);
+	return NULL;
+    }
+    fd = open(fullname, O_RDONLY);
+    Tcl_DStringFree(&nameBuffer);
+    if (fd < 0) {
+	return NULL;
+    }
+    if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) || (st.st_size <= 0)
+	    || (st.st_size > INT_MAX)) {
+	close(fd);
+	return NULL;
+    }
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+	return NULL;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+#endif
+    *sizePtr = (size_t) st.st_size;
+    return (char *) map;
 }
 
+#endif /* HAVE_MMAP */
+
 static int ObjReadPNG(interp, dataObj, format, imageHandle,
 	destX, destY, width, height, srcX, srcY)
     Tcl_Interp *interp;
@@ -349,20 +940,49 @@ static int ObjReadPNG(interp, dataObj, format, imageHandle,
     int width, height;
     int srcX, srcY;
 {
-    png_structp png_ptr;
     MFile handle;
+    PNGArena arena;
+    int result;
+
+    ImgReadInit(dataObj,'\211',&handle);
+
+    InitArenaPNG(&arena, 0);
+    result = ReadPNG(interp, &handle, &arena, format, imageHandle,
+	    destX, destY, width, height, srcX, srcY);
+    FreeArenaPNG(&arena);
+    return result;
+}
+
+/*
+ * Read the image of handlePtr into the photo, libpng's memory coming
+ * from arenaPtr. The caller frees or resets the arena afterwards.
+ */
+
+static int
+ReadPNG(interp, handlePtr, arenaPtr, format, imageHandle,
+	destX, destY, width, height, srcX, srcY)
+    Tcl_Interp *interp;
+    MFile *handlePtr;
+    PNGArena *arenaPtr;
+    Tcl_Obj *format;
+    Tk_PhotoHandle imageHandle;
+    int destX, destY;
+    int width, height;
+    int srcX, srcY;
+{
+    png_structp png_ptr;
     cleanup_info cleanup;
 
     cleanup.interp = interp;
     cleanup.data = NULL;
+    cleanup.samples = NULL;
 
-    png_ptr=png_create_read_struct(PNG_LIBPNG_VER_STRING,
-	    (png_voidp) &cleanup,tk_png_error,tk_png_warning);
-    if (!png_ptr) return TCL_ERROR;
-
-    ImgReadInit(dataObj,'\211',&handle);
+    png_ptr = CreateReadStructPNG(&cleanup, arenaPtr);
+    if (!png_ptr) {
+	return TCL_ERROR;
+    }
 
-    png_set_read_fn(png_ptr,(png_voidp) &handle, tk_png_read);
+    png_set_read_fn(png_ptr, (png_voidp) handlePtr, tk_png_read);
 
     return CommonReadPNG(png_ptr, format, imageHandle, destX, destY,
 	    width, height, srcX, srcY);
@@ -376,133 +996,1341 @@ typedef struct myblock {
 
 #define block bl.ck
 
-static int CommonReadPNG(png_ptr, format, imageHandle, destX, destY,
-	width, height, srcX, srcY)
-    png_structp png_ptr;
+/*
+ * Parse the options that may follow "png" in the format of a read.
+ * Words that don't start with '-' are skipped, as they always were.
+ */
+
+static int
+ParseReadOptions(interp, format, optPtr)
+    Tcl_Interp *interp;
     Tcl_Obj *format;
-    Tk_PhotoHandle imageHandle;
-    int destX, destY;
-#ifdef __GNUC__
-    volatile
-#endif
-    int width, height;
-    int srcX, srcY;
+    ReadOptions *optPtr;
 {
-    png_infop info_ptr;
-    png_infop end_info;
-    char **png_data = NULL;
-    myblock bl;
-    unsigned int I;
-    png_uint_32 info_width, info_height;
-    int bit_depth, color_type, interlace_type;
-    int intent;
-
-    info_ptr=png_create_info_struct(png_ptr);
-    if (!info_ptr) {
-	png_destroy_read_struct(&png_ptr,NULL,NULL);
-	return(TCL_ERROR);
-    }
+    int objc, I, index;
+    Tcl_Obj **objv = (Tcl_Obj **) NULL;
 
-    end_info=png_create_info_struct(png_ptr);
-    if (!end_info) {
-	png_destroy_read_struct(&png_ptr,&info_ptr,NULL);
-	return(TCL_ERROR);
-    }
+    optPtr->ignoreCrc = 0;
+    optPtr->bufferSize = 0;
+    optPtr->gamma = 0.0;
+    optPtr->scale = 1;
+    optPtr->passes = 7;
+    optPtr->samples16 = NULL;
 
-    if (setjmp(*(jmp_buf *) png_ptr)) {
-	png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+    if (ImgListObjGetElements(interp, format, &objc, &objv) != TCL_OK) {
 	return TCL_ERROR;
     }
-
-    png_read_info(png_ptr,info_ptr);
-
-    png_get_IHDR(png_ptr, info_ptr, &info_width, &info_height, &bit_depth,
-	&color_type, &interlace_type, (int *) NULL, (int *) NULL);
-
-    if ((srcX + width) > (int) info_width) {
-	width = info_width - srcX;
-    }
-    if ((srcY + height) > (int) info_height) {
-	height = info_height - srcY;
+    for (I = 1; I + 1 < objc; I += 2) {
+	if (*Tcl_GetStringFromObj(objv[I], (int *) NULL) != '-') {
+	    continue;
+	}
+	if (Tcl_GetIndexFromObj(interp, objv[I], readOptionStrings,
+		"option", 0, &index) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	switch ((enum readOptions) index) {
+	    case ROPT_BUFFERSIZE:
+		if (GetBufferSize(interp, objv[I+1], &optPtr->bufferSize)
+			!= TCL_OK) {
+		    return TCL_ERROR;
+		}
+		break;
+	    case ROPT_CRC:
+		if (Tcl_GetIndexFromObj(interp, objv[I+1], crcStrings,
+			"crc", 0, &optPtr->ignoreCrc) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+		break;
+	    case ROPT_GAMMA:
+		if (strcmp(Tcl_GetStringFromObj(objv[I+1], (int *) NULL),
+			"none") == 0) {
+		    optPtr->gamma = 0.0;
+		    break;
+		}
+		if (Tcl_GetDoubleFromObj(interp, objv[I+1], &optPtr->gamma)
+			!= TCL_OK) {
+		    return TCL_ERROR;
+		}
+		if (optPtr->gamma <= 0.0) {
+		    Tcl_AppendResult(interp, "gamma must be none or ",
+			    "a positive number", (char *) NULL);
+		    return TCL_ERROR;
+		}
+		break;
+	    case ROPT_PASSES:
+		if (Tcl_GetIntFromObj(interp, objv[I+1], &optPtr->passes)
+			!= TCL_OK) {
+		    return TCL_ERROR;
+		}
+		if ((optPtr->passes < 1) || (optPtr->passes > 7)) {
+		    Tcl_AppendResult(interp, "passes must be 1 to 7",
+			    (char *) NULL);
+		    return TCL_ERROR;
+		}
+		break;
+	    case ROPT_SAMPLES16:
+		optPtr->samples16 = objv[I+1];
+		break;
+	    case ROPT_SCALE: {
+		double scale;
+
+		if (Tcl_GetDoubleFromObj(interp, objv[I+1], &scale)
+			!= TCL_OK) {
+		    return TCL_ERROR;
+		}
+		if ((scale <= 0.0) || (scale > 1.0)) {
+		    Tcl_AppendResult(interp, "scale must be a number ",
+			    "above 0 and at most 1", (char *) NULL);
+		    return TCL_ERROR;
+		}
+		optPtr->scale = (1.0 / scale < 65536.0)
+			? (int) (1.0 / scale + 0.5) : 65536;
+		break;
+	    }
+	}
     }
-    if ((width <= 0) || (height <= 0)
-	|| (srcX >= (int) info_width)
-	|| (srcY >= (int) info_height)) {
-	return TCL_OK;
+    return TCL_OK;
+}
+
+/*
+ * Get the value of -buffersize, for reading or writing.
+ */
+
+static int
+GetBufferSize(interp, objPtr, sizePtr)
+    Tcl_Interp *interp;
+    Tcl_Obj *objPtr;
+    int *sizePtr;
+{
+    int value;
+
+    if (Tcl_GetIntFromObj(interp, objPtr, &value) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    if ((value < MIN_BUFFER_SIZE) || (value > MAX_BUFFER_SIZE)) {
+	Tcl_AppendResult(interp, "buffersize must be 1024 to 16777216",
+		(char *) NULL);
+	return TCL_ERROR;
     }
+    *sizePtr = value;
+    return TCL_OK;
+}
 
-    Tk_PhotoExpand(imageHandle, destX + width, destY + height);
+/*
+ * Install the transformations that turn any PNG into 8-bit samples
+ * the photo image understands, and describe the resulting rows in
+ * *blockPtr. The block's offsets must already hold those of the photo.
+ * A non-zero gamma is the display gamma to correct the samples for.
+ * With keep16 the samples of a 16-bit image stay 16-bit, and the block
+ * picks out their high bytes.
+ */
 
-    Tk_PhotoGetImage(imageHandle, &block);
+static void
+SetupReadPNG(png_ptr, info_ptr, blockPtr, gamma, keep16)
+    png_structp png_ptr;
+    png_infop info_ptr;
+    Tk_PhotoImageBlock *blockPtr;
+    double gamma;
+    int keep16;
+{
+    int bit_depth, color_type;
+    int intent;
+    double file_gamma;
+    int sampleSize = 1;
+
+    bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+    color_type = png_get_color_type(png_ptr, info_ptr);
 
-    if (png_set_strip_16 != NULL) {
+    if ((bit_depth == 16) && (keep16 || (png_set_strip_16 == NULL))) {
+	sampleSize = 2;
+	blockPtr->offset[1] *= 2;
+	blockPtr->offset[2] *= 2;
+    } else if (png_set_strip_16 != NULL) {
 	png_set_strip_16(png_ptr);
-    } else if (bit_depth == 16) {
-	block.offset[1] = 2;
-	block.offset[2] = 4;
     }
 
     if (png_set_expand != NULL) {
 	png_set_expand(png_ptr);
     }
 
+    /*
+     * The gamma transformation has to be known before png_read_update_info,
+     * which builds its tables. Untagged images are taken to be sRGB.
+     */
+
+    if ((gamma > 0.0) && (png_set_gamma != NULL)) {
+	if (png_get_sRGB && png_get_sRGB(png_ptr, info_ptr, &intent)) {
+	    file_gamma = 0.45455;
+	} else if (!png_get_gAMA
+		|| !png_get_gAMA(png_ptr, info_ptr, &file_gamma)) {
+	    file_gamma = 0.45455;
+	}
+	if (fabs(gamma * file_gamma - 1.0) > GAMMA_THRESHOLD) {
+	    png_set_gamma(png_ptr, gamma, file_gamma);
+	}
+    }
+
     png_read_update_info(png_ptr,info_ptr);
-    block.pixelSize = png_get_channels(png_ptr, info_ptr);
-    block.pitch = png_get_rowbytes(png_ptr, info_ptr);
+    blockPtr->pixelSize = png_get_channels(png_ptr, info_ptr) * sampleSize;
+    blockPtr->pitch = png_get_rowbytes(png_ptr, info_ptr);
 
     if ((color_type & PNG_COLOR_MASK_COLOR) == 0) {
 	/* grayscale image */
-	block.offset[1] = 0;
-	block.offset[2] = 0;
+	blockPtr->offset[1] = 0;
+	blockPtr->offset[2] = 0;
     }
-    block.width = width;
-    block.height = height;
 
     if ((color_type & PNG_COLOR_MASK_ALPHA)
 	    || png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
 	/* with alpha channel */
-	block.offset[3] = block.pixelSize - 1;
+	blockPtr->offset[3] = blockPtr->pixelSize - sampleSize;
     } else {
 	/* without alpha channel */
-	block.offset[3] = 0;
+	blockPtr->offset[3] = 0;
+    }
+}
+
+/*
+ * Copy the rows of *blockPtr to row y onwards of samples, which holds
+ * rows of blockPtr->width pixels without padding. Does nothing when
+ * samples is NULL, i.e. without -samples16 or for images of less than
+ * 16 bits.
+ */
+
+static void
+SaveSamples(samples, blockPtr, y)
+    char *samples;
+    Tk_PhotoImageBlock *blockPtr;
+    int y;
+{
+    int rowSize = blockPtr->width * blockPtr->pixelSize;
+    int row;
+
+    if (samples == NULL) {
+	return;
+    }
+    for (row = 0; row < blockPtr->height; row++) {
+	memcpy(samples + (y + row) * rowSize,
+		blockPtr->pixelPtr + row * blockPtr->pitch, (size_t) rowSize);
+    }
+}
+
+/*
+ * Store the size bytes of *samplesPtr in the variable of -samples16 and
+ * free them; *samplesPtr is NULL for images of less than 16 bits, and
+ * the variable is then set to an empty value.
+ */
+
+static int
+SetSamplesVar(interp, varObj, samplesPtr, size)
+    Tcl_Interp *interp;
+    Tcl_Obj *varObj;
+    char **samplesPtr;
+    int size;
+{
+    Tcl_Obj *valueObj;
+
+    if (*samplesPtr == NULL) {
+	size = 0;
+    }
+    valueObj = Tcl_NewByteArrayObj((unsigned char *) (size ? *samplesPtr
+	    : ""), size);
+    if (*samplesPtr != NULL) {
+	ckfree(*samplesPtr);
+	*samplesPtr = NULL;
+    }
+    if (Tcl_ObjSetVar2(interp, varObj, (Tcl_Obj *) NULL, valueObj,
+	    TCL_LEAVE_ERR_MSG) == NULL) {
+	return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ * Index of the first of the positions start, start + inc, ... below
+ * limit that is a multiple of scale, or -1 if there is none.
+ */
+
+static int
+FirstSample(start, inc, scale, limit)
+    int start, inc, scale, limit;
+{
+    int k;
+
+    for (k = 0; (k < scale) && (start + k * inc < limit); k++) {
+	if ((start + k * inc) % scale == 0) {
+	    return k;
+	}
+    }
+    return -1;
+}
+
+/*
+ * Read the image reduced by a factor of scale in both directions,
+ * keeping the pixels whose coordinates are both multiples of scale, and
+ * put the region srcX, srcY, width, height of the result into the photo.
+ * Only the reduced rows are stored: a non-interlaced image is decimated
+ * row by row into a band, and of an interlaced image only the passes
+ * that hold such pixels are read at all, without libpng's interlace
+ * handling, which would need full-size rows. The setjmp of the caller
+ * catches errors.
+ */
+
+static void
+ReadScaledPNG(png_ptr, imageHandle, blockPtr, scale, interlaced,
+	imageWidth, imageHeight, destX, destY, width, height, srcX, srcY)
+    png_structp png_ptr;
+    Tk_PhotoHandle imageHandle;
+    Tk_PhotoImageBlock *blockPtr;
+    int scale, interlaced;
+    int imageWidth, imageHeight;
+    int destX, destY;
+    int width, height;
+    int srcX, srcY;
+{
+    cleanup_info *cleanup = (cleanup_info *) png_get_error_ptr(png_ptr);
+    int pixelSize = blockPtr->pixelSize;
+    int outPitch = width * pixelSize;
+    int passes, lastPass, pass, band, done;
+    int xStart, xInc, yStart, yInc, passWidth, passHeight;
+    int k0, kStep, xStep, x0, j, k, x, y;
+    char *scratch, *out, *src, *dst;
+
+    /*
+     * Without interlacing the rows arrive in order, so the reduced rows
+     * go to the photo a band at a time and reading stops after the last
+     * one that is needed. Interlaced, the whole region is kept until the
+     * last useful pass.
+     */
+
+    passes = interlaced ? 7 : 1;
+    lastPass = 0;
+    for (pass = 0; pass < passes; pass++) {
+	if (interlaced && ((FirstSample(adam7XStart[pass], adam7XInc[pass],
+		scale, imageWidth) < 0) || (FirstSample(adam7YStart[pass],
+		adam7YInc[pass], scale, imageHeight) < 0))) {
+	    continue;
+	}
+	lastPass = pass;
+    }
+    band = height;
+    if (!interlaced) {
+	band = BAND_SIZE / outPitch;
+	if (band > height) {
+	    band = height;
+	} else if (band < 1) {
+	    band = 1;
+	}
+    }
+
+    scratch = ckalloc(blockPtr->pitch + band * outPitch);
+    cleanup->data = (char **) scratch;
+    out = scratch + blockPtr->pitch;
+
+    blockPtr->pixelPtr = (unsigned char *) out;
+    blockPtr->pitch = outPitch;
+    blockPtr->width = width;
+
+    done = 0;
+    for (pass = 0; pass <= lastPass; pass++) {
+	if (interlaced) {
+	    xStart = adam7XStart[pass];
+	    xInc = adam7XInc[pass];
+	    yStart = adam7YStart[pass];
+	    yInc = adam7YInc[pass];
+	} else {
+	    xStart = yStart = 0;
+	    xInc = yInc = 1;
+	}
+	if ((xStart >= imageWidth) || (yStart >= imageHeight)) {
+	    continue;		/* libpng skips empty passes */
+	}
+	passWidth = (imageWidth - xStart + xInc - 1) / xInc;
+	passHeight = (imageHeight - yStart + yInc - 1) / yInc;
+
+	/*
+	 * Pixel k0 of a row of this pass is the first one in the region
+	 * with a column that is a multiple of scale, and from there every
+	 * kStep'th pixel is, xStep columns further along in the result.
+	 */
+
+	k0 = FirstSample(xStart, xInc, scale, imageWidth);
+	for (kStep = 1; (kStep * xInc) % scale; kStep++) {
+	    /* empty */
+	}
+	xStep = kStep * xInc / scale;
+	x0 = 0;
+	if (k0 >= 0) {
+	    x0 = (xStart + k0 * xInc) / scale;
+	    if (x0 < srcX) {
+		k = (srcX - x0 + xStep - 1) / xStep;
+		k0 += k * kStep;
+		x0 += k * xStep;
+	    }
+	}
+
+	for (j = 0; (j < passHeight) && !done; j++) {
+	    png_read_row(png_ptr, (png_bytep) scratch, NULL);
+	    y = yStart + j * yInc;
+	    if ((y % scale) || (k0 < 0) || (y / scale < srcY)) {
+		continue;
+	    }
+	    y = y / scale - srcY;
+	    if (y >= height) {
+		continue;
+	    }
+	    src = scratch + k0 * pixelSize;
+	    dst = out + (y % band) * outPitch + (x0 - srcX) * pixelSize;
+	    for (k = k0, x = x0; (k < passWidth) && (x < srcX + width);
+		    k += kStep, x += xStep) {
+		memcpy(dst, src, (size_t) pixelSize);
+		src += kStep * pixelSize;
+		dst += xStep * pixelSize;
+	    }
+	    if (!interlaced && (((y + 1) % band == 0) || (y + 1 == height))) {
+		blockPtr->height = y % band + 1;
+		SaveSamples(cleanup->samples, blockPtr, y - y % band);
+		ImgPhotoPutBlock(imageHandle, blockPtr, destX,
+			destY + y - y % band, width, blockPtr->height);
+		done = (y + 1 == height);
+	    }
+	}
+    }
+    if (interlaced) {
+	blockPtr->height = height;
+	SaveSamples(cleanup->samples, blockPtr, 0);
+	ImgPhotoPutBlock(imageHandle, blockPtr, destX, destY, width, height);
+    }
+
+    ckfree(scratch);
+    cleanup->data = NULL;
+}
+
+static int CommonReadPNG(png_ptr, format, imageHandle, destX, destY,
+	width, height, srcX, srcY)
+    png_structp png_ptr;
+    Tcl_Obj *format;
+    Tk_PhotoHandle imageHandle;
+    int destX, destY;
+#ifdef __GNUC__
+    volatile
+#endif
+    int width, height;
+    int srcX, srcY;
+{
+    png_infop info_ptr;
+    png_infop end_info;
+    char **png_data = NULL;
+    myblock bl, photo;
+    unsigned int I;
+    int band, count, y, rows, direct;
+    int photoWidth, photoHeight;
+    char *scratch, *dest;
+    png_uint_32 info_width, info_height;
+    int bit_depth, color_type, interlace_type;
+    int scaledWidth, scaledHeight;
+    ReadOptions opts;
+    cleanup_info *cleanup = (cleanup_info *) png_get_error_ptr(png_ptr);
+
+    if (ParseReadOptions(((cleanup_info *) png_get_error_ptr(png_ptr))->interp,
+	    format, &opts) != TCL_OK) {
+	png_destroy_read_struct(&png_ptr,NULL,NULL);
+	return TCL_ERROR;
+    }
+
+    info_ptr=png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+	png_destroy_read_struct(&png_ptr,NULL,NULL);
+	return(TCL_ERROR);
+    }
+
+    end_info=png_create_info_struct(png_ptr);
+    if (!end_info) {
+	png_destroy_read_struct(&png_ptr,&info_ptr,NULL);
+	return(TCL_ERROR);
+    }
+
+    if (setjmp(*(jmp_buf *) png_ptr)) {
+	png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+	return TCL_ERROR;
+    }
+
+    if (opts.ignoreCrc && (png_set_crc_action != NULL)) {
+	png_set_crc_action(png_ptr, PNG_CRC_QUIET_USE, PNG_CRC_DEFAULT);
+    }
+    if (opts.bufferSize && (png_set_compression_buffer_size != NULL)) {
+	png_set_compression_buffer_size(png_ptr,
+		(png_uint_32) opts.bufferSize);
+    }
+
+    png_read_info(png_ptr,info_ptr);
+
+    png_get_IHDR(png_ptr, info_ptr, &info_width, &info_height, &bit_depth,
+	&color_type, &interlace_type, (int *) NULL, (int *) NULL);
+
+    scaledWidth = (int) ((info_width + opts.scale - 1) / opts.scale);
+    scaledHeight = (int) ((info_height + opts.scale - 1) / opts.scale);
+    if ((srcX + width) > scaledWidth) {
+	width = scaledWidth - srcX;
+    }
+    if ((srcY + height) > scaledHeight) {
+	height = scaledHeight - srcY;
+    }
+    if ((width <= 0) || (height <= 0)
+	|| (srcX >= scaledWidth)
+	|| (srcY >= scaledHeight)) {
+	png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+	if (opts.samples16 != NULL) {
+	    return SetSamplesVar(cleanup->interp, opts.samples16,
+		    &cleanup->samples, 0);
+	}
+	return TCL_OK;
+    }
+
+    Tk_PhotoGetSize(imageHandle, &photoWidth, &photoHeight);
+    Tk_PhotoExpand(imageHandle, destX + width, destY + height);
+
+    Tk_PhotoGetImage(imageHandle, &block);
+    photo = bl;
+
+    /*
+     * A preview of the first passes of an interlaced image is read with
+     * libpng's interlace handling, which has to be known before the
+     * transformations are set up.
+     */
+
+    if ((interlace_type != PNG_INTERLACE_NONE) && (opts.passes < 7)
+	    && (opts.scale == 1)) {
+	png_set_interlace_handling(png_ptr);
+    } else {
+	opts.passes = 7;
+    }
+
+    SetupReadPNG(png_ptr, info_ptr, &block, opts.gamma,
+	    opts.samples16 != NULL);
+    block.width = width;
+    block.height = height;
+
+    /*
+     * With -samples16 the 16-bit samples of the region are collected as
+     * they go to the photo, for the variable.
+     */
+
+    if ((opts.samples16 != NULL) && (bit_depth == 16)) {
+	cleanup->samples = ckalloc(width * height * block.pixelSize);
+    }
+
+    if (opts.scale > 1) {
+	ReadScaledPNG(png_ptr, imageHandle, &block, opts.scale,
+		interlace_type != PNG_INTERLACE_NONE, (int) info_width,
+		(int) info_height, destX, destY, width, height, srcX, srcY);
+	png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+	if (opts.samples16 != NULL) {
+	    return SetSamplesVar(cleanup->interp, opts.samples16,
+		    &cleanup->samples, width * height * block.pixelSize);
+	}
+	return TCL_OK;
+    }
+
+    /*
+     * When whole rows are read and they come out of libpng laid out like
+     * the pixels of the photo, they are inflated straight into the photo's
+     * own storage, and handing that to ImgPhotoPutBlock afterwards only
+     * tells the photo which region changed. Transparent pixels must not
+     * replace what the photo already shows, so images with alpha are
+     * only read this way into a region that was empty. Tk_PhotoExpand
+     * doesn't grow a photo past a -width or -height the user set, and
+     * then the storage may not hold the whole region.
+     */
+
+    direct = (srcX == 0) && (width == (int) info_width)
+	    && (photo.ck.width >= destX + width)
+	    && (photo.ck.height >= destY + height)
+	    && (block.pixelSize == photo.ck.pixelSize)
+	    && (block.offset[0] == photo.ck.offset[0])
+	    && (block.offset[1] == photo.ck.offset[1])
+	    && (block.offset[2] == photo.ck.offset[2])
+	    && ((block.pixelSize < 4)
+		|| (block.offset[3] == photo.ck.offset[3]))
+	    && ((block.offset[3] == 0) || (destX >= photoWidth)
+		|| (destY >= photoHeight));
+    dest = (char *) photo.ck.pixelPtr + destY * photo.ck.pitch
+	    + destX * photo.ck.pixelSize;
+
+    /*
+     * Rows outside the region srcY..srcY+height are never stored. A
+     * non-interlaced image inflates the rows before srcY into one scratch
+     * row and stops reading after the last row of the region. Interlaced
+     * images revisit every row in each pass, so there all rows outside
+     * the region share the single scratch row.
+     */
+
+    if (interlace_type == PNG_INTERLACE_NONE) {
+	band = BAND_SIZE / block.pitch;
+	if ((band > height) || direct) {
+	    band = height;
+	} else if (band < 1) {
+	    band = 1;
+	}
+	count = band;
+    } else {
+	band = height + 1;
+	count = info_height;
+    }
+
+    png_data= (char **) ckalloc(sizeof(char *) * count +
+	    (direct ? 1 : band) * block.pitch);
+
+    ((cleanup_info *) png_get_error_ptr(png_ptr))->data = png_data;
+    scratch = (char *) (png_data + count);
+    for(I=0;I<count;I++) {
+	if (interlace_type == PNG_INTERLACE_NONE) {
+	    png_data[I] = direct ? dest + I * photo.ck.pitch
+		    : scratch + I * block.pitch;
+	} else if (((int) I < srcY) || ((int) I >= srcY + height)) {
+	    png_data[I] = scratch;
+	} else if (direct) {
+	    png_data[I] = dest + (I - srcY) * photo.ck.pitch;
+	} else {
+	    png_data[I] = scratch + (I - srcY + 1) * block.pitch;
+	}
+    }
+    if (direct) {
+	block.pitch = photo.ck.pitch;
+    }
+
+    if (interlace_type == PNG_INTERLACE_NONE) {
+	for (y = 0; y < srcY; y++) {
+	    png_read_row(png_ptr, (png_bytep) scratch, NULL);
+	}
+	block.pixelPtr = (unsigned char *) (direct ? dest
+		: scratch + srcX * block.pixelSize);
+	for (y = 0; y < height; y += rows) {
+	    rows = height - y;
+	    if (rows > band) {
+		rows = band;
+	    }
+	    png_read_rows(png_ptr, (png_bytepp) png_data, NULL, rows);
+	    block.height = rows;
+	    SaveSamples(cleanup->samples, &block, y);
+	    ImgPhotoPutBlock(imageHandle, &block, destX, destY + y,
+		    width, rows);
+	}
+    } else {
+	block.pixelPtr=(unsigned char *) (png_data[srcY]+srcX*block.pixelSize);
+
+	if (opts.passes < 7) {
+	    /*
+	     * Each pass is read through the display rows, so that its
+	     * pixels are repeated over the rectangle up to the next pixel
+	     * of the pass. The rest of the image data is never inflated.
+	     * libpng says which pass and row come next, rather than every
+	     * pass being taken as info_height rows, as libpng may skip the
+	     * passes without pixels of images up to 4 pixels wide.
+	     */
+
+	    while (CurrentPassPNG(png_ptr) < opts.passes) {
+		png_read_row(png_ptr, NULL,
+			(png_bytep) png_data[CurrentRowPNG(png_ptr)]);
+	    }
+	} else {
+	    png_read_image(png_ptr,(png_bytepp) png_data);
+	}
+
+	SaveSamples(cleanup->samples, &block, 0);
+	ImgPhotoPutBlock(imageHandle,&block,destX,destY,width,height);
+    }
+
+    ckfree((char *) png_data);
+    ((cleanup_info *) png_get_error_ptr(png_ptr))->data = NULL;
+    png_data=NULL;
+
+    png_destroy_read_struct(&png_ptr,&info_ptr,&end_info);
+
+    if (opts.samples16 != NULL) {
+	return SetSamplesVar(cleanup->interp, opts.samples16,
+		&cleanup->samples, width * height * block.pixelSize);
+    }
+    return(TCL_OK);
+}
+
+/*
+ * State of an incremental decode fed by FeedProgressivePNG. The photo
+ * is looked up by name on every call, so deleting the image while data
+ * is still arriving makes the next call fail instead of crashing.
+ */
+
+struct ProgressivePNG {
+    char *imageName;
+    int destX, destY;
+    png_structp png_ptr;
+    png_infop info_ptr;
+    cleanup_info cleanup;
+    PNGArena arena;		/* Memory of png_ptr */
+    Tk_PhotoHandle imageHandle;	/* Only valid inside FeedProgressivePNG */
+    myblock bl;
+    int interlaced;
+    int band;			/* Number of rows that fit in "rows" */
+    char *rows;			/* Whole image if interlaced, else a band */
+    int first, last;		/* Rows not yet handed to the photo */
+    int finished;
+};
+
+ProgressivePNG *
+CreateProgressivePNG(interp, imageName, destX, destY)
+    Tcl_Interp *interp;
+    char *imageName;
+    int destX, destY;
+{
+    ProgressivePNG *progPtr;
+
+    progPtr = (ProgressivePNG *) ckalloc(sizeof(ProgressivePNG));
+    memset((VOID *) progPtr, 0, sizeof(ProgressivePNG));
+    progPtr->imageName = ckalloc(strlen(imageName) + 1);
+    strcpy(progPtr->imageName, imageName);
+    progPtr->destX = destX;
+    progPtr->destY = destY;
+    progPtr->cleanup.interp = interp;
+    progPtr->cleanup.data = NULL;
+    progPtr->cleanup.samples = NULL;
+
+    progPtr->png_ptr = CreateReadStructPNG(&progPtr->cleanup,
+	    &progPtr->arena);
+    if (progPtr->png_ptr) {
+	progPtr->info_ptr = png_create_info_struct(progPtr->png_ptr);
     }
+    if (!progPtr->info_ptr) {
+	DeleteProgressivePNG(progPtr);
+	return NULL;
+    }
+
+    png_set_progressive_read_fn(progPtr->png_ptr, (png_voidp) progPtr,
+	    ProgressiveInfo, ProgressiveRow, ProgressiveEnd);
+    return progPtr;
+}
+
+int
+FeedProgressivePNG(interp, progPtr, data, length)
+    Tcl_Interp *interp;
+    ProgressivePNG *progPtr;
+    unsigned char *data;
+    int length;
+{
+    if (progPtr->finished) {
+	return TCL_OK;
+    }
+    if (!progPtr->png_ptr) {
+	Tcl_AppendResult(interp, "PNG data already failed to decode",
+		NULL);
+	return TCL_ERROR;
+    }
+    progPtr->imageHandle = Tk_FindPhoto(interp, progPtr->imageName);
+    if (!progPtr->imageHandle) {
+	Tcl_AppendResult(interp, "image \"", progPtr->imageName,
+		"\" doesn't exist or is not a photo image", NULL);
+	return TCL_ERROR;
+    }
+    progPtr->cleanup.interp = interp;
+
+    if (setjmp(*(jmp_buf *) progPtr->png_ptr)) {
+	png_destroy_read_struct(&progPtr->png_ptr, &progPtr->info_ptr, NULL);
+	progPtr->png_ptr = NULL;
+	FreeArenaPNG(&progPtr->arena);
+	return TCL_ERROR;
+    }
+
+    png_process_data(progPtr->png_ptr, progPtr->info_ptr, (png_bytep) data,
+	    (png_size_t) length);
+    FlushProgressivePNG(progPtr);
+
+    if (progPtr->finished) {
+	png_destroy_read_struct(&progPtr->png_ptr, &progPtr->info_ptr, NULL);
+	progPtr->png_ptr = NULL;
+	FreeArenaPNG(&progPtr->arena);
+	if (progPtr->rows) {
+	    ckfree(progPtr->rows);
+	    progPtr->rows = NULL;
+	}
+    }
+    return TCL_OK;
+}
+
+int
+FinishedProgressivePNG(progPtr)
+    ProgressivePNG *progPtr;
+{
+    return progPtr->finished;
+}
+
+void
+DeleteProgressivePNG(progPtr)
+    ProgressivePNG *progPtr;
+{
+    if (progPtr->png_ptr) {
+	png_destroy_read_struct(&progPtr->png_ptr,
+		progPtr->info_ptr ? &progPtr->info_ptr : NULL, NULL);
+    }
+    FreeArenaPNG(&progPtr->arena);
+    if (progPtr->rows) {
+	ckfree(progPtr->rows);
+    }
+    ckfree(progPtr->imageName);
+    ckfree((char *) progPtr);
+}
+
+static void
+ProgressiveInfo(png_ptr, info_ptr)
+    png_structp png_ptr;
+    png_infop info_ptr;
+{
+    ProgressivePNG *progPtr;
+    png_uint_32 info_width, info_height;
+    int bit_depth, color_type, interlace_type;
+
+    progPtr = (ProgressivePNG *) png_get_progressive_ptr(png_ptr);
+    png_get_IHDR(png_ptr, info_ptr, &info_width, &info_height, &bit_depth,
+	&color_type, &interlace_type, (int *) NULL, (int *) NULL);
+
+    Tk_PhotoExpand(progPtr->imageHandle, progPtr->destX + info_width,
+	    progPtr->destY + info_height);
+    Tk_PhotoGetImage(progPtr->imageHandle, &progPtr->block);
+
+    progPtr->interlaced = (interlace_type != PNG_INTERLACE_NONE);
+    if (progPtr->interlaced) {
+	png_set_interlace_handling(png_ptr);
+    }
+    SetupReadPNG(png_ptr, info_ptr, &progPtr->block, 0.0, 0);
+    progPtr->block.width = info_width;
+
+    /*
+     * Rows of an interlaced image are refined by every pass, so they
+     * all have to be kept. libpng hands them over top down in the first
+     * pass, with its pixels repeated over those that later passes fill
+     * in, so every row put into the photo is whole: rows that no pass
+     * has reached yet are not put at all. Other images only keep the
+     * rows of one band.
+     */
+
+    if (progPtr->interlaced) {
+	progPtr->band = info_height;
+    } else {
+	progPtr->band = BAND_SIZE / progPtr->block.pitch;
+	if (progPtr->band < 1) {
+	    progPtr->band = 1;
+	} else if (progPtr->band > (int) info_height) {
+	    progPtr->band = info_height;
+	}
+    }
+    progPtr->rows = ckalloc(progPtr->band * progPtr->block.pitch);
+    if (progPtr->interlaced) {
+	memset((VOID *) progPtr->rows, 0, progPtr->band * progPtr->block.pitch);
+    }
+}
+
+static void
+ProgressiveRow(png_ptr, new_row, row_num, pass)
+    png_structp png_ptr;
+    png_bytep new_row;
+    png_uint_32 row_num;
+    int pass;
+{
+    ProgressivePNG *progPtr;
+    int y = (int) row_num;
+
+    if (!new_row) {
+	return;
+    }
+    progPtr = (ProgressivePNG *) png_get_progressive_ptr(png_ptr);
+
+    if (progPtr->interlaced) {
+	png_progressive_combine_row(png_ptr, (png_bytep) progPtr->rows
+		+ y * progPtr->block.pitch, new_row);
+	if (progPtr->first == progPtr->last) {
+	    progPtr->first = y;
+	    progPtr->last = y + 1;
+	} else if (y < progPtr->first) {
+	    progPtr->first = y;
+	} else if (y >= progPtr->last) {
+	    progPtr->last = y + 1;
+	}
+    } else {
+	if (progPtr->last - progPtr->first >= progPtr->band) {
+	    FlushProgressivePNG(progPtr);
+	}
+	if (progPtr->first == progPtr->last) {
+	    progPtr->first = progPtr->last = y;
+	}
+	memcpy(progPtr->rows + (y - progPtr->first) * progPtr->block.pitch,
+		new_row, progPtr->block.pitch);
+	progPtr->last = y + 1;
+    }
+}
+
+static void
+ProgressiveEnd(png_ptr, info_ptr)
+    png_structp png_ptr;
+    png_infop info_ptr;
+{
+    ProgressivePNG *progPtr;
+
+    progPtr = (ProgressivePNG *) png_get_progressive_ptr(png_ptr);
+    FlushProgressivePNG(progPtr);
+    progPtr->finished = 1;
+}
+
+/*
+ * Hand the rows decoded since the last call over to the photo.
+ */
+
+static void
+FlushProgressivePNG(progPtr)
+    ProgressivePNG *progPtr;
+{
+    if (progPtr->first >= progPtr->last) {
+	return;
+    }
+    progPtr->block.pixelPtr = (unsigned char *) progPtr->rows;
+    if (progPtr->interlaced) {
+	progPtr->block.pixelPtr += progPtr->first * progPtr->block.pitch;
+    }
+    progPtr->block.height = progPtr->last - progPtr->first;
+    ImgPhotoPutBlock(progPtr->imageHandle, &progPtr->block, progPtr->destX,
+	    progPtr->destY + progPtr->first, progPtr->block.width,
+	    progPtr->block.height);
+    progPtr->first = progPtr->last;
+}
+
+/*
+ * The chunks of a file or of data in memory, for InfoPNG. Chunks that
+ * aren't looked at, IDAT in particular, are skipped with a seek rather
+ * than read.
+ */
+
+typedef struct InfoSource {
+    FILE *file;			/* The file, or NULL for data */
+    unsigned char *data;
+    long length, pos;
+} InfoSource;
+
+static int
+InfoRead(srcPtr, buf, count)
+    InfoSource *srcPtr;
+    unsigned char *buf;
+    long count;
+{
+    if (srcPtr->file != NULL) {
+	return fread(buf, 1, (size_t) count, srcPtr->file) == (size_t) count;
+    }
+    if (count > srcPtr->length - srcPtr->pos) {
+	return 0;
+    }
+    memcpy(buf, srcPtr->data + srcPtr->pos, (size_t) count);
+    srcPtr->pos += count;
+    return 1;
+}
+
+static int
+InfoSkip(srcPtr, count)
+    InfoSource *srcPtr;
+    long count;
+{
+    if (srcPtr->file != NULL) {
+	return fseek(srcPtr->file, count, SEEK_CUR) == 0;
+    }
+    if (count > srcPtr->length - srcPtr->pos) {
+	return 0;
+    }
+    srcPtr->pos += count;
+    return 1;
+}
+
+#define INFO_UINT32(p) (((unsigned long) (p)[0] << 24) \
+	| ((unsigned long) (p)[1] << 16) | ((unsigned long) (p)[2] << 8) \
+	| (unsigned long) (p)[3])
+
+/*
+ * Fill *infoPtr from the IHDR chunk and the gAMA, sRGB, pHYs, tIME,
+ * tEXt and zTXt chunks of a PNG file, or of PNG data in memory when
+ * fileName is NULL. No image data is read, let alone inflated, and
+ * checksums aren't verified. Returns NULL, or an error message if the
+ * data isn't PNG. The keywords must be freed with FreeInfoPNG, also
+ * after an error.
+ */
+
+CONST char *
+InfoPNG(fileName, data, length, infoPtr)
+    char *fileName;
+    unsigned char *data;
+    int length;
+    PNGInfo *infoPtr;
+{
+    InfoSource src;
+    unsigned char buf[80];
+    unsigned long size;
+    long n;
+    int used;			/* Bytes of textKeys in use */
+    int space;			/* Bytes allocated for textKeys */
+    CONST char *error = NULL;
+
+    memset((char *) infoPtr, 0, sizeof(PNGInfo));
+    src.file = NULL;
+    src.data = data;
+    src.length = length;
+    src.pos = 0;
+    if (fileName != NULL) {
+	Tcl_DString nameBuffer;
+	char *fullname;
+
+	/*
+	 * Names like ~user/x.png are expanded as for -file; there is no
+	 * interpreter to leave an error message in.
+	 */
+
+	fullname = Tcl_TranslateFileName((Tcl_Interp *) NULL, fileName,
+		&nameBuffer);
+	if (fullname == NULL) {
+	    return "couldn't open file";
+	}
+	src.file = fopen(fullname, "rb");
+	Tcl_DStringFree(&nameBuffer);
+	if (src.file == NULL) {
+	    return "couldn't open file";
+	}
+    }
+
+    if (!InfoRead(&src, buf, 8)
+	    || (memcmp("\211PNG\15\12\32\12", (char *) buf, 8) != 0)
+	    || !InfoRead(&src, buf, 8 + 13 + 4)
+	    || (memcmp("IHDR", (char *) buf + 4, 4) != 0)) {
+	error = "not a PNG file";
+	goto done;
+    }
+    infoPtr->width = INFO_UINT32(buf + 8);
+    infoPtr->height = INFO_UINT32(buf + 12);
+    infoPtr->bitDepth = buf[16];
+    infoPtr->colorType = buf[17];
+    infoPtr->interlace = buf[20];
+
+    used = space = 0;
+    while (InfoRead(&src, buf, 8)) {
+	size = INFO_UINT32(buf);
+	if (size > 0x7fffffffL) {
+	    error = "bad chunk length";
+	    goto done;
+	}
+	if (memcmp("IEND", (char *) buf + 4, 4) == 0) {
+	    break;
+	}
+
+	/*
+	 * n is the number of bytes at the start of the chunk to read, the
+	 * rest of it and the CRC are skipped.
+	 */
+
+	n = 0;
+	if (((memcmp("gAMA", (char *) buf + 4, 4) == 0) && (size == 4))
+		|| ((memcmp("sRGB", (char *) buf + 4, 4) == 0) && (size == 1))
+		|| ((memcmp("pHYs", (char *) buf + 4, 4) == 0) && (size == 9))
+		|| ((memcmp("tIME", (char *) buf + 4, 4) == 0) && (size == 7))
+		|| (memcmp("tEXt", (char *) buf + 4, 4) == 0)
+		|| (memcmp("zTXt", (char *) buf + 4, 4) == 0)) {
+	    n = (size < sizeof(buf)) ? (long) size : (long) sizeof(buf);
+	}
+	if (n > 0) {
+	    char type[4];
+
+	    memcpy(type, (char *) buf + 4, 4);
+	    if (!InfoRead(&src, buf, n)) {
+		break;
+	    }
+	    if (memcmp("gAMA", type, 4) == 0) {
+		infoPtr->gamma = INFO_UINT32(buf) / 100000.0;
+		infoPtr->valid |= PNGINFO_GAMMA;
+	    } else if (memcmp("sRGB", type, 4) == 0) {
+		infoPtr->srgbIntent = buf[0];
+		infoPtr->valid |= PNGINFO_SRGB;
+	    } else if (memcmp("pHYs", type, 4) == 0) {
+		infoPtr->physX = INFO_UINT32(buf);
+		infoPtr->physY = INFO_UINT32(buf + 4);
+		infoPtr->physUnit = buf[8];
+		infoPtr->valid |= PNGINFO_PHYS;
+	    } else if (memcmp("tIME", type, 4) == 0) {
+		infoPtr->year = (buf[0] << 8) | buf[1];
+		infoPtr->month = buf[2];
+		infoPtr->day = buf[3];
+		infoPtr->hour = buf[4];
+		infoPtr->minute = buf[5];
+		infoPtr->second = buf[6];
+		infoPtr->valid |= PNGINFO_TIME;
+	    } else {
+		/* tEXt or zTXt: the keyword ends at the first '\0' */
+		int len = 0;
+
+		while ((len < n) && (len < 79) && buf[len]) {
+		    len++;
+		}
+		if (used + len + 1 > space) {
+		    space = 2 * space + 128;
+		    infoPtr->textKeys = infoPtr->textKeys
+			    ? ckrealloc(infoPtr->textKeys, space)
+			    : ckalloc(space);
+		}
+		memcpy(infoPtr->textKeys + used, (char *) buf, len);
+		infoPtr->textKeys[used + len] = '\0';
+		used += len + 1;
+		infoPtr->numText++;
+	    }
+	}
+	if (!InfoSkip(&src, (long) size - n + 4)) {
+	    break;
+	}
+    }
+
+done:
+    if (src.file != NULL) {
+	fclose(src.file);
+    }
+    return error;
+}
+
+void
+FreeInfoPNG(infoPtr)
+    PNGInfo *infoPtr;
+{
+    if (infoPtr->textKeys) {
+	ckfree(infoPtr->textKeys);
+	infoPtr->textKeys = NULL;
+    }
+}
+
+/*
+ * A PNGContext reads and writes images one after the other, keeping
+ * libpng's memory from one image to the next (see InitArenaPNG), which
+ * is most of the cost of a small image. It must not be used by two
+ * threads at once; a batch job keeps one per thread.
+ */
+
+struct PNGContext {
+    PNGArena arena;
+};
+
+PNGContext *
+CreateContextPNG()
+{
+    PNGContext *ctxPtr;
+
+    ctxPtr = (PNGContext *) ckalloc(sizeof(PNGContext));
+    InitArenaPNG(&ctxPtr->arena, 1);
+    return ctxPtr;
+}
+
+void
+DeleteContextPNG(ctxPtr)
+    PNGContext *ctxPtr;
+{
+    FreeArenaPNG(&ctxPtr->arena);
+    ckfree((char *) ctxPtr);
+}
+
+/*
+ * Read the whole of a PNG file, or of PNG data as accepted by -data,
+ * into the photo image named imageName at destX, destY.
+ */
+
+int
+ContextReadPNG(interp, ctxPtr, imageName, fileName, dataObj, format,
+	destX, destY)
+    Tcl_Interp *interp;
+    PNGContext *ctxPtr;
+    char *imageName;
+    char *fileName;
+    Tcl_Obj *dataObj;
+    Tcl_Obj *format;
+    int destX, destY;
+{
+    Tk_PhotoHandle imageHandle;
+    Tcl_Channel chan = NULL;
+    MFile handle;
+    int result;
+#ifdef HAVE_MMAP
+    char *map = NULL;
+    size_t size;
+#endif
+
+    if (load_png_library(interp) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    imageHandle = Tk_FindPhoto(interp, imageName);
+    if (!imageHandle) {
+	Tcl_AppendResult(interp, "image \"", imageName,
+		"\" doesn't exist or is not a photo image", NULL);
+	return TCL_ERROR;
+    }
+#ifdef HAVE_MMAP
+    if (fileName) {
+	map = MapFilePNG(interp, fileName, &size);
+    }
+    if (map) {
+	handle.data = map;
+	handle.length = (int) size;
+	handle.state = IMG_STRING;
+    } else
+#endif
+    if (fileName) {
+	chan = ImgOpenFileChannel(interp, fileName, 0);
+	if (!chan) {
+	    return TCL_ERROR;
+	}
+	handle.data = (char *) chan;
+	handle.state = IMG_CHAN;
+    } else if (!ImgReadInit(dataObj, '\211', &handle)) {
+	Tcl_AppendResult(interp, "couldn't recognize image data", NULL);
+	return TCL_ERROR;
+    }
+
+    result = ReadPNG(interp, &handle, &ctxPtr->arena, format, imageHandle,
+	    destX, destY, INT_MAX - destX, INT_MAX - destY, 0, 0);
+    ResetArenaPNG(&ctxPtr->arena);
+    if (chan) {
+	Tcl_Close(NULL, chan);
+    }
+#ifdef HAVE_MMAP
+    if (map) {
+	munmap((VOID *) map, size);
+    }
+#endif
+    return result;
+}
+
+/*
+ * Get the pixels of a photo as its "write" and "data" methods hand them
+ * to the format (ImgGetPhoto in tkImgPhoto.c, which is static): the red
+ * and green offsets are those of blue when every pixel is gray, and when
+ * every pixel is opaque the block starts one byte earlier, so that there
+ * is no alpha channel after blue.
+ */
+
+static void
+GetPhotoBlockPNG(imageHandle, blockPtr)
+    Tk_PhotoHandle imageHandle;
+    Tk_PhotoImageBlock *blockPtr;
+{
+    unsigned char *pixelPtr;
+    int x, y, gray = 1, opaque = 1;
+
+    Tk_PhotoGetImage(imageHandle, blockPtr);
+    for (y = 0; (y < blockPtr->height) && (gray || opaque); y++) {
+	pixelPtr = blockPtr->pixelPtr + y * blockPtr->pitch;
+	for (x = 0; (x < blockPtr->width) && (gray || opaque); x++) {
+	    if ((pixelPtr[blockPtr->offset[0]] != pixelPtr[blockPtr->offset[2]])
+		    || (pixelPtr[blockPtr->offset[1]]
+		    != pixelPtr[blockPtr->offset[2]])) {
+		gray = 0;
+	    }
+	    if ((blockPtr->pixelSize == 4)
+		    && (pixelPtr[blockPtr->offset[3]] != 255)) {
+		opaque = 0;
+	    }
+	    pixelPtr += blockPtr->pixelSize;
+	}
+    }
+    if (gray) {
+	blockPtr->offset[0] = blockPtr->offset[1] = blockPtr->offset[2];
+    }
+    if (opaque && (blockPtr->pixelSize == 4)) {
+	blockPtr->pixelPtr--;
+	blockPtr->offset[0]++;
+	blockPtr->offset[1]++;
+	blockPtr->offset[2]++;
+    }
+}
+
+/*
+ * Write the photo image named imageName to a file or, base64 encoded
+ * like its "data" method returns it, to the DString at dataPtr.
+ */
+
+int
+ContextWritePNG(interp, ctxPtr, imageName, fileName, dataPtr, format)
+    Tcl_Interp *interp;
+    PNGContext *ctxPtr;
+    char *imageName;
+    char *fileName;
+    Tcl_DString *dataPtr;
+    Tcl_Obj *format;
+{
+    Tk_PhotoHandle imageHandle;
+    myblock bl;
+    int result;
 
-    if (png_get_sRGB && png_get_sRGB(png_ptr, info_ptr, &intent)) {
-	png_set_sRGB(png_ptr, info_ptr, intent);
-    } else if (png_get_gAMA) {
-	double gamma;
-	if (!png_get_gAMA(png_ptr, info_ptr, &gamma)) {
-	    gamma = 0.45455;
-	}
-	png_set_gamma(png_ptr, 1.0, gamma);
+    if (load_png_library(interp) != TCL_OK) {
+	return TCL_ERROR;
     }
+    imageHandle = Tk_FindPhoto(interp, imageName);
+    if (!imageHandle) {
+	Tcl_AppendResult(interp, "image \"", imageName,
+		"\" doesn't exist or is not a photo image", NULL);
+	return TCL_ERROR;
+    }
+    GetPhotoBlockPNG(imageHandle, &block);
 
-    png_data= (char **) ckalloc(sizeof(char *) * info_height +
-	    info_height * block.pitch);
-
-    ((cleanup_info *) png_get_error_ptr(png_ptr))->data = png_data;
-    for(I=0;I<info_height;I++) {
-	png_data[I]= ((char *) png_data) + (sizeof(char *) * info_height +
-		I * block.pitch);
+    if (fileName) {
+	result = FileWritePNG(interp, fileName, &ctxPtr->arena, format,
+		&block);
+    } else {
+	result = DataWritePNG(interp, dataPtr, &ctxPtr->arena, format,
+		&block);
     }
-    block.pixelPtr=(unsigned char *) (png_data[srcY]+srcX*block.pixelSize);
+    ResetArenaPNG(&ctxPtr->arena);
+    return result;
+}
 
-    png_read_image(png_ptr,(png_bytepp) png_data);
+static int ChnWritePNG(interp, filename, format, blockPtr)
+    Tcl_Interp *interp;
+    char *filename;
+    Tcl_Obj *format;
+    Tk_PhotoImageBlock *blockPtr;
+{
+    PNGArena arena;
+    int result;
 
-    ImgPhotoPutBlock(imageHandle,&block,destX,destY,width,height);
+    InitArenaPNG(&arena, 0);
+    result = FileWritePNG(interp, filename, &arena, format, blockPtr);
+    FreeArenaPNG(&arena);
+    return result;
+}
 
-    ckfree((char *) png_data);
-    ((cleanup_info *) png_get_error_ptr(png_ptr))->data = NULL;
-    png_data=NULL;
+static int StringWritePNG(interp, dataPtr, format, blockPtr)
+    Tcl_Interp *interp;
+    Tcl_DString *dataPtr;
+    Tcl_Obj *format;
+    Tk_PhotoImageBlock *blockPtr;
+{
+    PNGArena arena;
+    int result;
+    Tcl_DString data;
 
-    png_destroy_read_struct(&png_ptr,&info_ptr,&end_info);
+    ImgFixStringWriteProc(&data, &interp, &dataPtr, &format, &blockPtr);
 
-    return(TCL_OK);
+    InitArenaPNG(&arena, 0);
+    result = DataWritePNG(interp, dataPtr, &arena, format, blockPtr);
+    FreeArenaPNG(&arena);
+    if ((result == TCL_OK) && (dataPtr == &data)) {
+	Tcl_DStringResult(interp, dataPtr);
+    }
+    return result;
 }
 
-static int ChnWritePNG(interp, filename, format, blockPtr)
+/*
+ * Write the block to a file or, base64 encoded, to a DString. libpng's
+ * memory comes from arenaPtr, which the caller frees or resets.
+ */
+
+static int
+FileWritePNG(interp, filename, arenaPtr, format, blockPtr)
     Tcl_Interp *interp;
     char *filename;
+    PNGArena *arenaPtr;
     Tcl_Obj *format;
     Tk_PhotoImageBlock *blockPtr;
 {
@@ -529,10 +2357,13 @@ static int ChnWritePNG(interp, filename, format, blockPtr)
 
     cleanup.interp = interp;
     cleanup.data = (char **) NULL;
+    cleanup.samples = NULL;
 
-    png_ptr=png_create_write_struct(PNG_LIBPNG_VER_STRING,
-	    (png_voidp) &cleanup,tk_png_error,tk_png_warning);
-    if (!png_ptr) return TCL_ERROR;
+    png_ptr = CreateWriteStructPNG(&cleanup, arenaPtr);
+    if (!png_ptr) {
+	fclose(outfile);
+	return TCL_ERROR;
+    }
 
     info_ptr=png_create_info_struct(png_ptr);
     if (!info_ptr) {
@@ -548,9 +2379,11 @@ static int ChnWritePNG(interp, filename, format, blockPtr)
     return result;
 }
 
-static int StringWritePNG(interp, dataPtr, format, blockPtr)
+static int
+DataWritePNG(interp, dataPtr, arenaPtr, format, blockPtr)
     Tcl_Interp *interp;
     Tcl_DString *dataPtr;
+    PNGArena *arenaPtr;
     Tcl_Obj *format;
     Tk_PhotoImageBlock *blockPtr;
 {
@@ -559,15 +2392,12 @@ static int StringWritePNG(interp, dataPtr, format, blockPtr)
     MFile handle;
     int result;
     cleanup_info cleanup;
-    Tcl_DString data;
-
-    ImgFixStringWriteProc(&data, &interp, &dataPtr, &format, &blockPtr);
 
     cleanup.interp = interp;
     cleanup.data = (char **) NULL;
+    cleanup.samples = NULL;
 
-    png_ptr=png_create_write_struct(PNG_LIBPNG_VER_STRING,
-	    (png_voidp) &cleanup,tk_png_error,tk_png_warning);
+    png_ptr = CreateWriteStructPNG(&cleanup, arenaPtr);
     if (!png_ptr) {
 	return TCL_ERROR;
     }
@@ -584,12 +2414,799 @@ static int StringWritePNG(interp, dataPtr, format, blockPtr)
 
     result = CommonWritePNG(interp, png_ptr, info_ptr, format, blockPtr);
     ImgPutc(IMG_DONE, &handle);
-    if ((result == TCL_OK) && (dataPtr == &data)) {
-	Tcl_DStringResult(interp, dataPtr);
-    }
     return result;
 }
 
+/*
+ * Parse the options that may follow "png" in the format of a write.
+ * Every other pair of arguments names a text chunk, and is only counted.
+ */
+
+static int
+ParseWriteOptions(interp, format, optPtr)
+    Tcl_Interp *interp;
+    Tcl_Obj *format;
+    WriteOptions *optPtr;
+{
+    int objc, I, index, flag, value;
+    Tcl_Obj **objv = (Tcl_Obj **) NULL;
+
+    optPtr->interlace = PNG_INTERLACE_ADAM7;
+    optPtr->level = -1;
+    optPtr->strategy = -1;
+    optPtr->memLevel = -1;
+    optPtr->windowBits = -1;
+    optPtr->filter = -1;
+    optPtr->bufferSize = 0;
+    optPtr->tags = 0;
+    optPtr->threads = 1;
+
+    if (ImgListObjGetElements(interp, format, &objc, &objv) != TCL_OK) {
+	return TCL_ERROR;
+    }
+    optPtr->endOptions = objc;
+    for (I = 1; I + 1 < objc; I += 2) {
+	char *word = Tcl_GetStringFromObj(objv[I], (int *) NULL);
+
+	if (strcmp(word, "--") == 0) {
+	    optPtr->endOptions = I;
+	    optPtr->tags += (objc - I - 1) / 2;
+	    break;
+	}
+	if (*word != '-') {
+	    optPtr->tags++;
+	    continue;
+	}
+	if (Tcl_GetIndexFromObj(interp, objv[I], writeOptionStrings,
+		"option", 0, &index) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	switch ((enum writeOptions) index) {
+	    case WOPT_BUFFERSIZE:
+		if (GetBufferSize(interp, objv[I+1], &optPtr->bufferSize)
+			!= TCL_OK) {
+		    return TCL_ERROR;
+		}
+		break;
+	    case WOPT_INTERLACE:
+		if (Tcl_GetBooleanFromObj(interp, objv[I+1], &flag) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+		optPtr->interlace = flag ? PNG_INTERLACE_ADAM7
+			: PNG_INTERLACE_NONE;
+		break;
+	    case WOPT_COMPRESSION:
+		if (Tcl_GetIndexFromObj((Tcl_Interp *) NULL, objv[I+1],
+			compressionStrings, "compression", 0, &value) == TCL_OK) {
+		    if (value == 1) {
+			optPtr->level = 1;
+			optPtr->strategy = FAST_STRATEGY;
+		    } else {
+			optPtr->level = (value == 2) ? 9 : -1;
+		    }
+		    break;
+		}
+		if (Tcl_GetIntFromObj(interp, objv[I+1], &value) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+		if ((value < 0) || (value > 9)) {
+		    Tcl_AppendResult(interp, "compression level must be ",
+			    "fast, max, default or 0 to 9", (char *) NULL);
+		    return TCL_ERROR;
+		}
+		optPtr->level = value;
+		break;
+	    case WOPT_FILTER:
+		if (Tcl_GetIndexFromObj(interp, objv[I+1], filterStrings,
+			"filter", 0, &optPtr->filter) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+		break;
+	    case WOPT_STRATEGY:
+		if (Tcl_GetIndexFromObj(interp, objv[I+1], strategyStrings,
+			"strategy", 0, &value) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+		optPtr->strategy = value ? strategyValues[value] : -1;
+		break;
+	    case WOPT_MEMLEVEL:
+		if (Tcl_GetIntFromObj(interp, objv[I+1], &value) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+		if ((value < 1) || (value > 9)) {
+		    Tcl_AppendResult(interp, "memlevel must be 1 to 9",
+			    (char *) NULL);
+		    return TCL_ERROR;
+		}
+		optPtr->memLevel = value;
+		break;
+	    case WOPT_THREADS:
+		if (Tcl_GetIntFromObj(interp, objv[I+1], &value) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+		if ((value < 1) || (value > MAX_THREADS)) {
+		    Tcl_AppendResult(interp, "threads must be 1 to 256",
+			    (char *) NULL);
+		    return TCL_ERROR;
+		}
+		optPtr->threads = value;
+		break;
+	    case WOPT_WINDOWBITS:
+		if (Tcl_GetIntFromObj(interp, objv[I+1], &value) != TCL_OK) {
+		    return TCL_ERROR;
+		}
+		if ((value < 8) || (value > 15)) {
+		    Tcl_AppendResult(interp, "windowbits must be 8 to 15",
+			    (char *) NULL);
+		    return TCL_ERROR;
+		}
+		optPtr->windowBits = value;
+		break;
+	}
+    }
+    return TCL_OK;
+}
+
+/*
+ * Pick one filter for the whole image by trying all five on a sample
+ * of FILTER_SAMPLE_ROWS rows, scored by the same sum of absolute
+ * differences libpng's adaptive filtering computes for every row.
+ */
+
+static int
+ChooseFilterPNG(blockPtr, pixelSize)
+    Tk_PhotoImageBlock *blockPtr;
+    int pixelSize;
+{
+    unsigned long sum[5];
+    int rowbytes = blockPtr->width * pixelSize;
+    int step, y, x, i, best;
+    png_bytep prev, row, src;
+
+    prev = (png_bytep) ckalloc(2 * rowbytes);
+    row = prev + rowbytes;
+    memset((VOID *) sum, 0, sizeof(sum));
+
+    step = blockPtr->height / FILTER_SAMPLE_ROWS;
+    if (step < 1) {
+	step = 1;
+    }
+    for (y = step / 2; y < blockPtr->height; y += step) {
+	for (i = 0; i < 2; i++) {
+	    png_bytep dst = i ? row : prev;
+	    if (y + i - 1 < 0) {
+		memset((VOID *) dst, 0, rowbytes);
+		continue;
+	    }
+	    src = (png_bytep) blockPtr->pixelPtr
+		    + (y + i - 1) * blockPtr->pitch + blockPtr->offset[0];
+	    for (x = blockPtr->width; x > 0; x--) {
+		memcpy(dst, src, pixelSize);
+		src += blockPtr->pixelSize;
+		dst += pixelSize;
+	    }
+	}
+	for (x = 0; x < rowbytes; x++) {
+	    int r = row[x], b = prev[x];
+	    int a = (x >= pixelSize) ? row[x - pixelSize] : 0;
+	    int c = (x >= pixelSize) ? prev[x - pixelSize] : 0;
+	    int p = a + b - c;
+	    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	    int v[5];
+
+	    v[0] = r;
+	    v[1] = (r - a) & 0xff;
+	    v[2] = (r - b) & 0xff;
+	    v[3] = (r - ((a + b) >> 1)) & 0xff;
+	    v[4] = (r - ((pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c)) & 0xff;
+	    for (i = 0; i < 5; i++) {
+		sum[i] += (v[i] < 128) ? v[i] : 256 - v[i];
+	    }
+	}
+    }
+    ckfree((char *) prev);
+
+    best = 0;
+    for (i = 1; i < 5; i++) {
+	if (sum[i] < sum[best]) {
+	    best = i;
+	}
+    }
+    return filterValues[best];
+}
+
+#ifdef HAVE_PTHREAD
+
+/*
+ * Parallel compression for -threads. The scanlines of all passes are
+ * filtered into one buffer, which is cut into pieces that are deflated
+ * at the same time as raw streams. Each piece gets the 32K of scanlines
+ * before it as preset dictionary and ends on a byte boundary with
+ * Z_SYNC_FLUSH, the last one with Z_FINISH, so that the pieces joined
+ * behind a zlib header and followed by the combined Adler-32 form a
+ * single valid zlib stream, as pigz does. The compression is a little
+ * worse than in one stream, as no match crosses into the next piece.
+ *
+ * Filtering a row only needs that row and the one above it from the
+ * photo, so it is shared out too: the rows starting in a piece form one
+ * filter batch, and the threads take turns at the tasks "filter batch 0,
+ * filter batch 1, compress piece 0, filter batch 2, compress piece 1,
+ * ...". A piece waits for the batches it and its dictionary lie in,
+ * which are always ahead of it, so filtering overlaps with compression.
+ */
+
+typedef struct ScanLine {
+    unsigned long start;	/* Offset of the filter byte */
+    int y, prevY;		/* Row in the photo, and the row above it
+				 * in the pass, or -1 */
+    int xStart, xInc, width;	/* Pixels of the row in the pass */
+} ScanLine;
+
+typedef struct DeflateJob {
+    png_bytep in;		/* Scanlines to compress */
+    uLong inLength;
+    int dictLength;		/* Bytes before "in" to use as dictionary */
+    int last;
+    int firstBatch, lastBatch;	/* Filter batches "in" and the dictionary
+				 * lie in */
+    png_bytep out;
+    uLong outSize, outLength;
+    uLong adler;		/* Adler-32 of the scanlines */
+    int error;
+} DeflateJob;
+
+typedef struct DeflateWork {
+    Tk_PhotoImageBlock *blockPtr;
+    int pixelSize, filter;
+    png_bytep data;		/* All scanlines */
+    ScanLine *lines;
+    int *batches;		/* First line of each batch, and numLines */
+    char *filtered;		/* Which batches are done */
+    DeflateJob *jobs;
+    int numJobs, numThreads;
+    int level, windowBits, memLevel, strategy;
+    int *tasks;			/* 2k filters batch k, 2k+1 compresses k */
+    int nextTask;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} DeflateWork;
+
+typedef struct DeflateThread {
+    DeflateWork *workPtr;
+    png_bytep rows;		/* Room for 3 rows, for FilterBatch */
+} DeflateThread;
+
+/*
+ * Filter one row of rowbytes bytes with the given PNG filter type, prev
+ * being the row above (zeros for the first row of a pass), into
+ * out[0..rowbytes], filter byte first. Returns the sum of absolute
+ * values that libpng's adaptive filtering minimizes.
+ */
+
+static unsigned long
+FilterRowPNG(type, row, prev, rowbytes, bpp, out)
+    int type;
+    png_bytep row, prev;
+    int rowbytes, bpp;
+    png_bytep out;
+{
+    unsigned long sum = 0;
+    int i, v;
+
+    *out++ = (png_byte) type;
+    switch (type) {
+	case 0:
+	    memcpy(out, row, rowbytes);
+	    break;
+	case 1:
+	    memcpy(out, row, bpp);
+	    for (i = bpp; i < rowbytes; i++) {
+		out[i] = (png_byte) (row[i] - row[i - bpp]);
+	    }
+	    break;
+	case 2:
+	    for (i = 0; i < rowbytes; i++) {
+		out[i] = (png_byte) (row[i] - prev[i]);
+	    }
+	    break;
+	case 3:
+	    for (i = 0; i < bpp; i++) {
+		out[i] = (png_byte) (row[i] - (prev[i] >> 1));
+	    }
+	    for (; i < rowbytes; i++) {
+		out[i] = (png_byte) (row[i] - ((row[i - bpp] + prev[i]) >> 1));
+	    }
+	    break;
+	default:
+	    for (i = 0; i < bpp; i++) {
+		out[i] = (png_byte) (row[i] - prev[i]);
+	    }
+	    for (; i < rowbytes; i++) {
+		int a = row[i - bpp], b = prev[i], c = prev[i - bpp];
+		int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+
+		out[i] = (png_byte) (row[i] - ((pa <= pb && pa <= pc) ? a
+			: (pb <= pc) ? b : c));
+	    }
+	    break;
+    }
+    for (i = 0; i < rowbytes; i++) {
+	v = out[i];
+	sum += (v < 128) ? v : 256 - v;
+    }
+    return sum;
+}
+
+/*
+ * Copy the pixels of a scanline from row y of the photo to dst.
+ */
+
+static void
+PackLinePNG(workPtr, linePtr, y, dst)
+    DeflateWork *workPtr;
+    ScanLine *linePtr;
+    int y;
+    png_bytep dst;
+{
+    Tk_PhotoImageBlock *blockPtr = workPtr->blockPtr;
+    int pixelSize = workPtr->pixelSize;
+    int step = linePtr->xInc * blockPtr->pixelSize;
+    png_bytep src;
+    int x;
+
+    src = (png_bytep) blockPtr->pixelPtr + y * blockPtr->pitch
+	    + linePtr->xStart * blockPtr->pixelSize + blockPtr->offset[0];
+    for (x = linePtr->width; x > 0; x--) {
+	memcpy(dst, src, pixelSize);
+	src += step;
+	dst += pixelSize;
+    }
+}
+
+/*
+ * Filter the scanlines of one batch into workPtr->data, with -filter's
+ * type or, without one, the type with the lowest sum for each line.
+ */
+
+static void
+FilterBatchPNG(workPtr, batch, rows)
+    DeflateWork *workPtr;
+    int batch;
+    png_bytep rows;
+{
+    int rowbytes = workPtr->blockPtr->width * workPtr->pixelSize + 1;
+    png_bytep cur = rows, prev = rows + rowbytes, tmp = prev + rowbytes;
+    png_bytep dst, p;
+    ScanLine *linePtr;
+    unsigned long sum, bestSum;
+    int i, type, bytes;
+
+    for (i = workPtr->batches[batch]; i < workPtr->batches[batch + 1]; i++) {
+	linePtr = workPtr->lines + i;
+	bytes = linePtr->width * workPtr->pixelSize;
+	dst = workPtr->data + linePtr->start;
+	PackLinePNG(workPtr, linePtr, linePtr->y, cur);
+	if (linePtr->prevY < 0) {
+	    memset((VOID *) prev, 0, bytes);
+	} else if (i == workPtr->batches[batch]) {
+	    PackLinePNG(workPtr, linePtr, linePtr->prevY, prev);
+	}
+	if (workPtr->filter >= 0) {
+	    FilterRowPNG(workPtr->filter, cur, prev, bytes,
+		    workPtr->pixelSize, dst);
+	} else {
+	    bestSum = FilterRowPNG(0, cur, prev, bytes, workPtr->pixelSize,
+		    dst);
+	    for (type = 1; type < 5; type++) {
+		sum = FilterRowPNG(type, cur, prev, bytes, workPtr->pixelSize,
+			tmp);
+		if (sum < bestSum) {
+		    bestSum = sum;
+		    memcpy(dst, tmp, bytes + 1);
+		}
+	    }
+	}
+	p = prev;
+	prev = cur;
+	cur = p;
+    }
+}
+
+static void
+DeflateJobPNG(workPtr, jobPtr)
+    DeflateWork *workPtr;
+    DeflateJob *jobPtr;
+{
+    z_stream stream;
+    int result;
+
+    memset((VOID *) &stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, workPtr->level, Z_DEFLATED,
+	    -workPtr->windowBits, workPtr->memLevel,
+	    workPtr->strategy) != Z_OK) {
+	jobPtr->error = 1;
+	return;
+    }
+    if (jobPtr->dictLength) {
+	deflateSetDictionary(&stream, jobPtr->in - jobPtr->dictLength,
+		(uInt) jobPtr->dictLength);
+    }
+    stream.next_in = jobPtr->in;
+    stream.avail_in = (uInt) jobPtr->inLength;
+    stream.next_out = jobPtr->out;
+    stream.avail_out = (uInt) jobPtr->outSize;
+    result = deflate(&stream, jobPtr->last ? Z_FINISH : Z_SYNC_FLUSH);
+
+    /*
+     * A sync flush that fills the buffer may not have written all of
+     * its output; outSize leaves room for it, so that is an error.
+     */
+
+    if ((result != (jobPtr->last ? Z_STREAM_END : Z_OK))
+	    || (stream.avail_in != 0)
+	    || (!jobPtr->last && (stream.avail_out == 0))) {
+	jobPtr->error = 1;
+    }
+    jobPtr->outLength = stream.total_out;
+    jobPtr->adler = adler32(adler32(0L, Z_NULL, 0), jobPtr->in,
+	    (uInt) jobPtr->inLength);
+    deflateEnd(&stream);
+}
+
+static void *
+DeflateThreadProc(clientData)
+    void *clientData;
+{
+    DeflateThread *threadPtr = (DeflateThread *) clientData;
+    DeflateWork *workPtr = threadPtr->workPtr;
+    DeflateJob *jobPtr;
+    int task, k;
+
+    for (;;) {
+	pthread_mutex_lock(&workPtr->mutex);
+	task = (workPtr->nextTask < 2 * workPtr->numJobs)
+		? workPtr->tasks[workPtr->nextTask++] : -1;
+	pthread_mutex_unlock(&workPtr->mutex);
+	if (task < 0) {
+	    break;
+	}
+	if ((task & 1) == 0) {
+	    FilterBatchPNG(workPtr, task / 2, threadPtr->rows);
+	    pthread_mutex_lock(&workPtr->mutex);
+	    workPtr->filtered[task / 2] = 1;
+	    pthread_cond_broadcast(&workPtr->cond);
+	    pthread_mutex_unlock(&workPtr->mutex);
+	} else {
+	    jobPtr = workPtr->jobs + task / 2;
+	    pthread_mutex_lock(&workPtr->mutex);
+	    for (k = jobPtr->firstBatch; k <= jobPtr->lastBatch; k++) {
+		while (!workPtr->filtered[k]) {
+		    pthread_cond_wait(&workPtr->cond, &workPtr->mutex);
+		}
+	    }
+	    pthread_mutex_unlock(&workPtr->mutex);
+	    DeflateJobPNG(workPtr, jobPtr);
+	}
+    }
+    return NULL;
+}
+
+/*
+ * Index of the scanline that holds byte offset of the scanlines.
+ */
+
+static int
+FindLinePNG(lines, numLines, offset)
+    ScanLine *lines;
+    int numLines;
+    unsigned long offset;
+{
+    int lo = 0, hi = numLines - 1, mid;
+
+    while (lo < hi) {
+	mid = (lo + hi + 1) / 2;
+	if (lines[mid].start <= offset) {
+	    lo = mid;
+	} else {
+	    hi = mid - 1;
+	}
+    }
+    return lo;
+}
+
+/*
+ * Write the image data of *blockPtr, with pixelSize bytes of each pixel
+ * from offset[0] on, as IDAT chunks followed by IEND, filtering and
+ * compressing on optPtr->threads threads. filter is a PNG filter type,
+ * or -1 to choose one per row as libpng does. Errors go to png_error.
+ * Returns 0 without writing anything when the buffers for the whole
+ * image would not fit in one allocation, so that the caller writes it
+ * on one thread instead, and 1 otherwise.
+ */
+
+static int
+ParallelWritePNG(png_ptr, blockPtr, optPtr, pixelSize, filter)
+    png_structp png_ptr;
+    Tk_PhotoImageBlock *blockPtr;
+    WriteOptions *optPtr;
+    int pixelSize;
+    int filter;
+{
+    cleanup_info *cleanup = (cleanup_info *) png_get_error_ptr(png_ptr);
+    int width = blockPtr->width, height = blockPtr->height;
+    int passes = (optPtr->interlace == PNG_INTERLACE_NONE) ? 1 : 7;
+    int pass, xStart, xInc, yStart, yInc, passWidth, y;
+    int rowbytes = width * pixelSize + 1;
+    int windowBits, chunkSize, numJobs, numLines, i, n;
+    unsigned long total, outTotal, offset;
+    png_bytep buf, src, dst, chunk;
+    ScanLine *lines;
+    DeflateJob *jobs;
+    DeflateWork work;
+    z_stream stream;
+    DeflateThread threads[MAX_THREADS];
+    pthread_t ids[MAX_THREADS];
+    int started[MAX_THREADS];
+    uLong adler;
+    png_byte header[4];
+    int fill;
+    double size;
+
+    /*
+     * Count the scanlines of all passes. A pass without pixels has no
+     * scanlines at all, not even filter bytes. Sizes are added up as
+     * doubles first, which can't overflow.
+     */
+
+    numLines = 0;
+    total = 0;
+    size = 0.0;
+    for (pass = 0; pass < passes; pass++) {
+	xStart = (passes > 1) ? adam7XStart[pass] : 0;
+	xInc = (passes > 1) ? adam7XInc[pass] : 1;
+	yStart = (passes > 1) ? adam7YStart[pass] : 0;
+	yInc = (passes > 1) ? adam7YInc[pass] : 1;
+	if ((xStart < width) && (yStart < height)) {
+	    passWidth = (width - xStart + xInc - 1) / xInc;
+	    n = (height - yStart + yInc - 1) / yInc;
+	    numLines += n;
+	    size += (double) n * ((double) passWidth * pixelSize + 1.0);
+	    if (size > (double) INT_MAX) {
+		return 0;
+	    }
+	    total += (unsigned long) n * (passWidth * pixelSize + 1);
+	}
+    }
+    numJobs = (int) ((total + DEFLATE_JOB_SIZE - 1) / DEFLATE_JOB_SIZE);
+
+    /*
+     * The zlib parameters default to those libpng would use. The room
+     * for each compressed piece depends on them, and the flush at its
+     * end adds a few bytes.
+     */
+
+    work.level = (optPtr->level >= 0) ? optPtr->level : Z_DEFAULT_COMPRESSION;
+    work.memLevel = (optPtr->memLevel >= 0) ? optPtr->memLevel : 8;
+    work.strategy = (optPtr->strategy >= 0) ? optPtr->strategy
+	    : (filter == 0) ? Z_DEFAULT_STRATEGY : Z_FILTERED;
+    windowBits = (optPtr->windowBits >= 0) ? optPtr->windowBits : 15;
+    if (windowBits < 9) {
+	windowBits = 9;		/* zlib has no raw streams with 256 bytes */
+    }
+    work.windowBits = windowBits;
+
+    memset((VOID *) &stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, work.level, Z_DEFLATED, -windowBits,
+	    work.memLevel, work.strategy) != Z_OK) {
+	png_error(png_ptr, "zlib failed to initialize compressor");
+    }
+    outTotal = 0;
+    for (i = 0; i < numJobs; i++) {
+	uLong length = (i < numJobs - 1) ? DEFLATE_JOB_SIZE
+		: total - (unsigned long) i * DEFLATE_JOB_SIZE;
+	outTotal += deflateBound(&stream, length) + 16;
+    }
+    chunkSize = optPtr->bufferSize ? optPtr->bufferSize : 8192;
+    work.numThreads = (optPtr->threads < numJobs) ? optPtr->threads
+	    : numJobs;
+
+    size = (double) numJobs * sizeof(DeflateJob)
+	    + (double) numLines * sizeof(ScanLine)
+	    + (double) (3 * numJobs + 1) * sizeof(int) + (double) total
+	    + (double) outTotal + (double) work.numThreads * 3 * rowbytes
+	    + numJobs + chunkSize;
+    if (size > (double) INT_MAX) {
+	deflateEnd(&stream);
+	return 0;
+    }
+    buf = (png_bytep) ckalloc(numJobs * sizeof(DeflateJob)
+	    + numLines * sizeof(ScanLine) + (numJobs + 1) * sizeof(int)
+	    + 2 * numJobs * sizeof(int) + total + outTotal
+	    + work.numThreads * 3 * rowbytes + numJobs + chunkSize);
+    cleanup->data = (char **) buf;
+    jobs = (DeflateJob *) buf;
+    lines = (ScanLine *) (jobs + numJobs);
+    work.batches = (int *) (lines + numLines);
+    work.tasks = work.batches + numJobs + 1;
+    work.data = (png_bytep) (work.tasks + 2 * numJobs);
+    dst = work.data + total + outTotal;
+    for (i = 0; i < work.numThreads; i++) {
+	threads[i].workPtr = &work;
+	threads[i].rows = dst;
+	dst += 3 * rowbytes;
+    }
+    work.filtered = (char *) dst;
+    chunk = dst + numJobs;
+
+    /*
+     * Lay out the scanlines, and make the lines starting in each piece
+     * a filter batch.
+     */
+
+    n = 0;
+    offset = 0;
+    for (pass = 0; pass < passes; pass++) {
+	xStart = (passes > 1) ? adam7XStart[pass] : 0;
+	xInc = (passes > 1) ? adam7XInc[pass] : 1;
+	yStart = (passes > 1) ? adam7YStart[pass] : 0;
+	yInc = (passes > 1) ? adam7YInc[pass] : 1;
+	if ((xStart >= width) || (yStart >= height)) {
+	    continue;
+	}
+	passWidth = (width - xStart + xInc - 1) / xInc;
+	for (y = yStart; y < height; y += yInc, n++) {
+	    lines[n].start = offset;
+	    lines[n].y = y;
+	    lines[n].prevY = (y == yStart) ? -1 : y - yInc;
+	    lines[n].xStart = xStart;
+	    lines[n].xInc = xInc;
+	    lines[n].width = passWidth;
+	    offset += passWidth * pixelSize + 1;
+	}
+    }
+    n = 0;
+    for (i = 0; i < numJobs; i++) {
+	while ((n < numLines)
+		&& (lines[n].start < (unsigned long) i * DEFLATE_JOB_SIZE)) {
+	    n++;
+	}
+	work.batches[i] = n;
+	work.filtered[i] = 0;
+    }
+    work.batches[numJobs] = numLines;
+
+    work.blockPtr = blockPtr;
+    work.pixelSize = pixelSize;
+    work.filter = filter;
+    work.lines = lines;
+    work.jobs = jobs;
+    work.numJobs = numJobs;
+    dst = work.data + total;
+    for (i = 0; i < numJobs; i++) {
+	offset = (unsigned long) i * DEFLATE_JOB_SIZE;
+	jobs[i].in = work.data + offset;
+	jobs[i].inLength = (i < numJobs - 1) ? DEFLATE_JOB_SIZE
+		: total - offset;
+	jobs[i].dictLength = (i == 0) ? 0 : (1 << windowBits);
+	jobs[i].last = (i == numJobs - 1);
+	jobs[i].firstBatch = FindLinePNG(lines, numLines,
+		offset - jobs[i].dictLength);
+	jobs[i].lastBatch = FindLinePNG(lines, numLines,
+		offset + jobs[i].inLength - 1);
+	jobs[i].out = dst;
+	jobs[i].outSize = deflateBound(&stream, jobs[i].inLength) + 16;
+	jobs[i].error = 0;
+	dst += jobs[i].outSize;
+    }
+    deflateEnd(&stream);
+
+    /*
+     * FindLinePNG gave lines, turn them into the batches holding them.
+     */
+
+    for (i = 0; i < numJobs; i++) {
+	for (n = 0; work.batches[n + 1] <= jobs[i].firstBatch; n++) {
+	    /* empty */
+	}
+	jobs[i].firstBatch = n;
+	for (; work.batches[n + 1] <= jobs[i].lastBatch; n++) {
+	    /* empty */
+	}
+	jobs[i].lastBatch = n;
+    }
+
+    n = 0;
+    for (i = 0; i < numJobs; i++) {
+	work.tasks[n++] = 2 * i;
+	if (i > 0) {
+	    work.tasks[n++] = 2 * (i - 1) + 1;
+	}
+    }
+    work.tasks[n++] = 2 * (numJobs - 1) + 1;
+    work.nextTask = 0;
+
+    /*
+     * Run. The calling thread works too, and also takes over the share
+     * of a thread that can't be started.
+     */
+
+    pthread_mutex_init(&work.mutex, NULL);
+    pthread_cond_init(&work.cond, NULL);
+    for (i = 1; i < work.numThreads; i++) {
+	started[i] = (pthread_create(&ids[i], NULL, DeflateThreadProc,
+		(void *) &threads[i]) == 0);
+    }
+    DeflateThreadProc((void *) &threads[0]);
+    for (i = 1; i < work.numThreads; i++) {
+	if (started[i]) {
+	    pthread_join(ids[i], NULL);
+	}
+    }
+    pthread_cond_destroy(&work.cond);
+    pthread_mutex_destroy(&work.mutex);
+
+    adler = adler32(0L, Z_NULL, 0);
+    for (i = 0; i < numJobs; i++) {
+	if (jobs[i].error) {
+	    png_error(png_ptr, "zlib error while compressing");
+	}
+	adler = adler32_combine(adler, jobs[i].adler, jobs[i].inLength);
+    }
+
+    /*
+     * Join the pieces into IDAT chunks of chunkSize bytes.
+     */
+
+    header[0] = (png_byte) (Z_DEFLATED | ((windowBits - 8) << 4));
+    header[1] = (png_byte) (((work.level == Z_DEFAULT_COMPRESSION)
+	    || (work.level == 6)) ? 2 : (work.level < 2) ? 0
+	    : (work.level < 6) ? 1 : 3) << 6;
+    header[1] += (31 - (header[0] * 256 + header[1]) % 31) % 31;
+    memcpy(chunk, header, 2);
+    fill = 2;
+    for (i = 0; i <= numJobs; i++) {
+	uLong length;
+
+	if (i < numJobs) {
+	    src = jobs[i].out;
+	    length = jobs[i].outLength;
+	} else {
+	    header[0] = (png_byte) (adler >> 24);
+	    header[1] = (png_byte) (adler >> 16);
+	    header[2] = (png_byte) (adler >> 8);
+	    header[3] = (png_byte) adler;
+	    src = header;
+	    length = 4;
+	}
+	while (length > 0) {
+	    uLong count = chunkSize - fill;
+
+	    if (count > length) {
+		count = length;
+	    }
+	    memcpy(chunk + fill, src, count);
+	    fill += (int) count;
+	    src += count;
+	    length -= count;
+	    if (fill == chunkSize) {
+		png_write_chunk(png_ptr, (png_bytep) "IDAT", chunk,
+			(png_size_t) fill);
+		fill = 0;
+	    }
+	}
+    }
+    if (fill) {
+	png_write_chunk(png_ptr, (png_bytep) "IDAT", chunk, (png_size_t) fill);
+    }
+    png_write_chunk(png_ptr, (png_bytep) "IEND", NULL, (png_size_t) 0);
+
+    ckfree((char *) buf);
+    cleanup->data = NULL;
+    return 1;
+}
+
+#endif /* HAVE_PTHREAD */
+
 static int CommonWritePNG(interp, png_ptr, info_ptr, format, blockPtr)
     Tcl_Interp *interp;
     png_structp png_ptr;
@@ -601,14 +3218,17 @@ static int CommonWritePNG(interp, png_ptr, info_ptr, format, blockPtr)
     int tagcount = 0;
     Tcl_Obj **tags = (Tcl_Obj **) NULL;
     int I, pass, number_passes, color_type;
-    int newPixelSize;
+    int newPixelSize, firstByte, filterMask;
     png_bytep row_pointers;
     png_textp text = (png_textp) NULL;
+    WriteOptions opts;
 
-    if (ImgListObjGetElements(interp, format, &tagcount, &tags) != TCL_OK) {
+    if ((ParseWriteOptions(interp, format, &opts) != TCL_OK)
+	    || (ImgListObjGetElements(interp, format, &tagcount, &tags)
+	    != TCL_OK)) {
+	png_destroy_write_struct(&png_ptr,&info_ptr);
 	return TCL_ERROR;
     }
-    tagcount = (tagcount > 1) ? (tagcount/2 - 1) : 0;
 
     if (setjmp(*(jmp_buf *)png_ptr)) {
 	if (text) {
@@ -639,36 +3259,57 @@ static int CommonWritePNG(interp, png_ptr, info_ptr, format, blockPtr)
     if (alphaOffset) {
 	color_type |= PNG_COLOR_MASK_ALPHA;
 	newPixelSize++;
-#if 0 /* The function png_set_filler doesn't seem to work; don't known why :-( */
-    } else if ((blockPtr->pixelSize==4) && (newPixelSize == 3)
-	    && (png_set_filler != NULL)) {
-	/*
-	 * The set_filler() function doesn't need to be called
-	 * because the code below can handle all necessary
-	 * re-allocation of memory. Only it is more economically
-	 * to let the PNG library do that, which is only
-	 * possible with v0.95 and higher.
-	 */
-	png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
-	newPixelSize++;
-#endif
     }
 
     png_set_IHDR(png_ptr, info_ptr, blockPtr->width, blockPtr->height, 8,
-	    color_type, PNG_INTERLACE_ADAM7, PNG_COMPRESSION_TYPE_BASE,
+	    color_type, opts.interlace, PNG_COMPRESSION_TYPE_BASE,
 	    PNG_FILTER_TYPE_BASE);
 
+    filterMask = -1;
+    if (opts.filter == FILTER_AUTO) {
+	filterMask = ChooseFilterPNG(blockPtr, newPixelSize);
+    } else if (opts.filter >= 0) {
+	filterMask = filterValues[opts.filter];
+    }
+    if (filterMask >= 0) {
+	png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filterMask);
+    }
+
+    if (opts.level >= 0) {
+	png_set_compression_level(png_ptr, opts.level);
+    }
+    if (opts.strategy >= 0) {
+	png_set_compression_strategy(png_ptr, opts.strategy);
+    }
+    if (opts.memLevel >= 0) {
+	png_set_compression_mem_level(png_ptr, opts.memLevel);
+    }
+    if (opts.windowBits >= 0) {
+	png_set_compression_window_bits(png_ptr, opts.windowBits);
+    }
+    if (opts.bufferSize && (png_set_compression_buffer_size != NULL)) {
+	png_set_compression_buffer_size(png_ptr,
+		(png_uint_32) opts.bufferSize);
+    }
+
     if (png_set_gAMA) {
 	png_set_gAMA(png_ptr, info_ptr, 1.0);
     }
 
-    if (tagcount > 0) {
+    if (opts.tags > 0) {
 	png_text text;
-	for(I=0;I<tagcount;I++) {
+	for(I=1;I+1<tagcount;I+=2) {
 	    int length;
+	    if (I == opts.endOptions) {
+		I--;		/* The pairs after "--" start one later */
+		continue;
+	    }
 	    text.compression = 0;
-	    text.key = Tcl_GetStringFromObj(tags[2*I+1], (int *) NULL);
-	    text.text = Tcl_GetStringFromObj(tags[2*I+2], &length);
+	    text.key = Tcl_GetStringFromObj(tags[I], (int *) NULL);
+	    if ((I < opts.endOptions) && (*text.key == '-')) {
+		continue;
+	    }
+	    text.text = Tcl_GetStringFromObj(tags[I+1], &length);
 	    text.text_length = length;
 	    if (text.text_length>COMPRESS_THRESHOLD) {
 		text.compression = -1;
@@ -678,6 +3319,46 @@ static int CommonWritePNG(interp, png_ptr, info_ptr, format, blockPtr)
     }
     png_write_info(png_ptr,info_ptr);
 
+#ifdef HAVE_PTHREAD
+    if ((opts.threads > 1) && (png_write_chunk != NULL)) {
+	int filter = -1;
+
+	for (I = 0; I < 5; I++) {
+	    if (filterMask == filterValues[I]) {
+		filter = I;
+	    }
+	}
+	if (ParallelWritePNG(png_ptr, blockPtr, &opts, newPixelSize,
+		filter)) {
+	    if (text) {
+		ckfree((char *) text);
+	    }
+	    png_destroy_write_struct(&png_ptr,&info_ptr);
+	    return TCL_OK;
+	}
+    }
+#endif
+
+    /*
+     * When the only extra byte of a 4-byte pixel is unused, libpng's
+     * filler transformation drops it while copying each row, so the
+     * rows need not be repacked here. png_set_filler must come after
+     * png_write_info, because writing the IHDR chunk resets the channel
+     * count that png_set_filler adjusts. The rows start at the red byte,
+     * so the filler is the byte after blue: for an opaque photo, whose
+     * block ImgGetPhoto starts one byte before its pixels, that is the
+     * alpha byte, where the byte before red would lie outside the
+     * pixels on the first row.
+     */
+
+    firstByte = blockPtr->offset[0];
+    if ((blockPtr->pixelSize == 4) && (newPixelSize == 3)
+	    && (greenOffset == 1) && (blueOffset == 2) && (firstByte <= 1)
+	    && (png_set_filler != NULL)) {
+	png_set_filler(png_ptr, 0, PNG_FILLER_AFTER);
+	newPixelSize++;
+    }
+
     number_passes = png_set_interlace_handling(png_ptr);
 
     if (blockPtr->pixelSize != newPixelSize) {
@@ -704,7 +3385,7 @@ static int CommonWritePNG(interp, png_ptr, info_ptr, format, blockPtr)
 	for (pass = 0; pass < number_passes; pass++) {
 	    for(I=0;I<blockPtr->height;I++) {
 		row_pointers = (png_bytep) blockPtr->pixelPtr
-			+ I * blockPtr->pitch + blockPtr->offset[0];
+			+ I * blockPtr->pitch + firstByte;
 		png_write_row(png_ptr, row_pointers);
 	    }
 	}
@@ -0,0 +1,65 @@
+/*
+ * imgPNG.h --
+ *
+ * Entry points of imgPNG.c that PNG.xs calls directly, rather than
+ * through the photo image format record.
+ */
+
+#ifndef _IMGPNG_H
+#define _IMGPNG_H
+
+typedef struct ProgressivePNG ProgressivePNG;
+
+extern ProgressivePNG *CreateProgressivePNG _ANSI_ARGS_((Tcl_Interp *interp,
+	char *imageName, int destX, int destY));
+extern int FeedProgressivePNG _ANSI_ARGS_((Tcl_Interp *interp,
+	ProgressivePNG *progPtr, unsigned char *data, int length));
+extern int FinishedProgressivePNG _ANSI_ARGS_((ProgressivePNG *progPtr));
+extern void DeleteProgressivePNG _ANSI_ARGS_((ProgressivePNG *progPtr));
+
+/*
+ * A context reads and writes whole images one after the other, keeping
+ * libpng's memory between them. The file name is NULL for data.
+ */
+
+typedef struct PNGContext PNGContext;
+
+extern PNGContext *CreateContextPNG _ANSI_ARGS_((void));
+extern void DeleteContextPNG _ANSI_ARGS_((PNGContext *ctxPtr));
+extern int ContextReadPNG _ANSI_ARGS_((Tcl_Interp *interp,
+	PNGContext *ctxPtr, char *imageName, char *fileName,
+	Tcl_Obj *dataObj, Tcl_Obj *format, int destX, int destY));
+extern int ContextWritePNG _ANSI_ARGS_((Tcl_Interp *interp,
+	PNGContext *ctxPtr, char *imageName, char *fileName,
+	Tcl_DString *dataPtr, Tcl_Obj *format));
+
+/*
+ * Header information of a PNG file, as found by InfoPNG without
+ * decoding any pixels. The flags in "valid" tell which of the optional
+ * fields were present in the file.
+ */
+
+#define PNGINFO_GAMMA	1
+#define PNGINFO_SRGB	2
+#define PNGINFO_PHYS	4
+#define PNGINFO_TIME	8
+
+typedef struct PNGInfo {
+    unsigned long width, height;
+    int bitDepth, colorType, interlace;
+    int valid;			/* PNGINFO_* flags */
+    double gamma;		/* gAMA */
+    int srgbIntent;		/* sRGB */
+    unsigned long physX, physY;	/* pHYs */
+    int physUnit;
+    int year, month, day;	/* tIME */
+    int hour, minute, second;
+    int numText;		/* Keywords of tEXt and zTXt chunks, */
+    char *textKeys;		/* each followed by a '\0' */
+} PNGInfo;
+
+extern CONST char *InfoPNG _ANSI_ARGS_((char *fileName,
+	unsigned char *data, int length, PNGInfo *infoPtr));
+extern void FreeInfoPNG _ANSI_ARGS_((PNGInfo *infoPtr));
+
+#endif /* _IMGPNG_H */
@@ -814,6 +814,10 @@ struct png_struct_def
     defined(PNG_WRITE_EMPTY_PLTE_SUPPORTED)
    png_byte empty_plte_permitted;
 #endif
+#if defined(PNG_READ_FUSED_TRANSFORMS_SUPPORTED)
+   png_byte fused_transform;         /* one-pass kernel for the transforms */
+   png_bytep fused_table;            /* lookup table of that kernel */
+#endif
 };
 
 /* This prevents a compiler error in png_get_copyright() in png.c if png.c
@@ -1227,6 +1231,14 @@ extern PNG_EXPORT(void,png_set_compression_window_bits)
 extern PNG_EXPORT(void,png_set_compression_method) PNGARG((png_structp png_ptr,
    int method));
 
+/* Set the size of the buffer zlib reads compressed data from (on read)
+ * or deflates into (on write), PNG_ZBUF_SIZE by default.  On write this
+ * is also the size of each IDAT chunk.  Call it before png_read_info()
+ * or png_write_info().
+ */
+extern PNG_EXPORT(void,png_set_compression_buffer_size)
+   PNGARG((png_structp png_ptr, png_uint_32 size));
+
 /* These next functions are called for input/output, memory, and error
  * handling.  They are in the file pngrio.c, pngwio.c, and pngerror.c,
  * and call standard C I/O routines such as fread(), fwrite(), and
@@ -1773,6 +1785,7 @@ png_get_header_version(png_structp png_ptr) \
 #define PNG_FLAG_HAVE_CHUNK_HEADER        0x8000L
 #define PNG_FLAG_WROTE_tIME              0x10000L
 #define PNG_FLAG_BACKGROUND_IS_GRAY      0x20000L
+#define PNG_FLAG_SHARED_GAMMA            0x40000L
 
 #define PNG_FLAG_CRC_ANCILLARY_MASK (PNG_FLAG_CRC_ANCILLARY_USE | \
                                      PNG_FLAG_CRC_ANCILLARY_NOWARN)
@@ -1857,9 +1870,9 @@ PNG_EXTERN png_voidp png_create_struct PNGARG((int type));
 PNG_EXTERN void png_destroy_struct PNGARG((png_voidp struct_ptr));
 
 PNG_EXTERN png_voidp png_create_struct_2 PNGARG((int type, png_malloc_ptr
-  malloc_fn));
+  malloc_fn, png_voidp mem_ptr));
 PNG_EXTERN void png_destroy_struct_2 PNGARG((png_voidp struct_ptr,
-   png_free_ptr free_fn));
+   png_free_ptr free_fn, png_voidp mem_ptr));
 
 /* free any memory that info_ptr points to and reset struct. */
 PNG_EXTERN void png_info_destroy PNGARG((png_structp png_ptr,
@@ -18,15 +18,15 @@
 #define PNG_HAVE_ASSEMBLER_READ_FILTER_ROW
 #endif
 
-/* Set this in the makefile for gcc on Pentium, not in pngconf.h */
+/* Set this in the makefile for gcc on x86 or x86-64, not in pngconf.h */
 #ifdef PNG_USE_PNGGCCRD
-/* Platform must be Pentium.  Makefile must assemble and load pnggccrd.c
- * (not available in libpng 1.0.5).
- * MMX will be detected at run time and used if present.
+/* Makefile must compile and load pnggccrd.c.  Only the row unfilter is
+ * replaced; SSE2 and AVX2 will be detected at run time and used if
+ * present.  On other platforms the flag is ignored.
  */
-#define PNG_HAVE_ASSEMBLER_COMBINE_ROW
-#define PNG_HAVE_ASSEMBLER_READ_INTERLACE
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 #define PNG_HAVE_ASSEMBLER_READ_FILTER_ROW
 #endif
+#endif
 
 #endif
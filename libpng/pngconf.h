@@ -34,6 +34,13 @@
 #define PNG_ZBUF_SIZE 8192
 #endif
 
+/* Number of different sets of gamma tables kept by the gamma cache
+ * (PNG_READ_GAMMA_CACHE_SUPPORTED below).
+ */
+#ifndef PNG_GAMMA_CACHE_SIZE
+#define PNG_GAMMA_CACHE_SIZE 16
+#endif
+
 /* If you are running on a machine where you cannot allocate more
  * than 64K of memory at once, uncomment this.  While libpng will not
  * normally need that much memory in a chunk (unless you load up a very
@@ -306,6 +313,23 @@ __dont__ include it again
 #ifndef PNG_NO_READ_GAMMA
 #define PNG_READ_GAMMA_SUPPORTED
 #endif
+/* Share the gamma tables of images with the same gammas instead of
+ * building them for each image (see png_build_gamma_table()).  The cache
+ * belongs to the process and is updated with the compiler's atomic
+ * builtins (gcc 4.7 or clang), without which it is left out.
+ */
+#if !defined(PNG_NO_READ_GAMMA_CACHE) && !defined(PNG_NO_READ_GAMMA) && \
+    !defined(PNG_MAX_MALLOC_64K) && defined(__ATOMIC_ACQUIRE)
+#define PNG_READ_GAMMA_CACHE_SUPPORTED
+#endif
+/* Do the common combinations of expand, 16-to-8 and gamma in a single
+ * pass over the row (see png_init_read_fused() in pngrtran.c).
+ */
+#if !defined(PNG_NO_READ_FUSED_TRANSFORMS) && \
+    defined(PNG_READ_EXPAND_SUPPORTED) && \
+    defined(PNG_READ_16_TO_8_SUPPORTED) && defined(PNG_READ_GAMMA_SUPPORTED)
+#define PNG_READ_FUSED_TRANSFORMS_SUPPORTED
+#endif
 #ifndef PNG_NO_READ_GRAY_TO_RGB
 #define PNG_READ_GRAY_TO_RGB_SUPPORTED
 #endif
@@ -418,12 +442,27 @@ __dont__ include it again
 #define PNG_ASSEMBLER_CODE_SUPPORTED
 #endif
 
+/* Compute chunk CRCs with libpng's own slice-by-8 tables (and PCLMULQDQ
+ * where gcc and the CPU have it) rather than zlib's crc32().  Define
+ * PNG_NO_PCLMUL_CRC to keep the tables but leave out the x86 kernel.
+ */
+#ifndef PNG_NO_FAST_CRC
+#define PNG_FAST_CRC_SUPPORTED
+#endif
+
+/* Let applications supply their own png_malloc() and png_free() through
+ * png_create_read_struct_2() and png_create_write_struct_2(); the photo
+ * handler reads each image into an arena that way.
+ */
+#ifndef PNG_NO_USER_MEM
+#define PNG_USER_MEM_SUPPORTED
+#endif
+
 /* These are currently experimental features, define them if you want */
 
 /* very little testing */
 /*
 #define PNG_READ_16_TO_8_ACCURATE_SCALE_SUPPORTED
-#define PNG_USER_MEM_SUPPORTED
 */
 
 /* This is only for PowerPC big-endian and 680x0 systems */
@@ -0,0 +1,403 @@
+/* pnggccrd.c - SSE2/AVX2 version of the row unfilter for gcc on x86
+ *
+ * For Intel x86 and x86-64 CPUs and the gcc compiler (or a compiler that
+ * understands gcc's target attributes and the Intel intrinsics headers)
+ *
+ * libpng 1.0.5 - October 15, 1999
+ * For conditions of distribution and use, see copyright notice in png.h
+ *
+ * This is the gcc counterpart of the filter code in pngvcrd.c.  Only
+ * png_read_filter_row() is replaced; png_combine_row() and
+ * png_do_read_interlace() stay in C.  The Sub, Avg and Paeth filters are
+ * done with SIMD for 3- and 4-byte pixels (8-bit RGB and RGBA), the Up
+ * filter for every pixel size.  Anything else goes to the C code in
+ * pngrutil.c, which is renamed to png_read_filter_row_c() when this file
+ * is in use.  The results are bit-for-bit the same as the C code.
+ *
+ * SSE2 and AVX2 support is detected with CPUID on the first call.  The
+ * Avg and Paeth predictors depend on the pixel just decoded to the left,
+ * so they are done one pixel per step in 16-bit lanes and the wider AVX2
+ * registers gain nothing there; AVX2 is used for Up and Sub only.
+ */
+
+#define PNG_INTERNAL
+#include "png.h"
+
+#ifdef PNG_ASSEMBLER_CODE_SUPPORTED
+#include "pngasmrd.h"
+#endif
+
+#if defined(PNG_ASSEMBLER_CODE_SUPPORTED) && defined(PNG_USE_PNGGCCRD) && \
+    defined(PNG_HAVE_ASSEMBLER_READ_FILTER_ROW)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define PNG_GCCRD_SSE2  __attribute__((target("sse2")))
+#define PNG_GCCRD_AVX2  __attribute__((target("avx2")))
+#define PNG_GCCRD_INLINE \
+   __inline__ __attribute__((always_inline, target("sse2")))
+
+/* 0 = plain C, 1 = SSE2, 2 = AVX2, -1 = not yet probed */
+static int png_gccrd_level = -1;
+
+void
+png_read_filter_row_c(png_structp png_ptr, png_row_infop row_info,
+   png_bytep row, png_bytep prev_row, int filter);
+
+static int
+png_gccrd_cpu_level(void)
+{
+   unsigned int eax, ebx, ecx, edx;
+   unsigned int xcr0_lo, xcr0_hi;
+   int level = 0;
+
+   if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+      return 0;
+   if (edx & bit_SSE2)
+      level = 1;
+
+   /* AVX2 needs the CPU bit and the OS saving the YMM state (XCR0 bits
+    * 1 and 2, which can only be read when OSXSAVE is set). */
+   if (level && (ecx & bit_OSXSAVE) && (ecx & bit_AVX))
+   {
+      __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+      if ((xcr0_lo & 6) == 6 && __get_cpuid_max(0, NULL) >= 7)
+      {
+         __cpuid_count(7, 0, eax, ebx, ecx, edx);
+         if (ebx & bit_AVX2)
+            level = 2;
+      }
+   }
+   return level;
+}
+
+/* Pixels of 3 or 4 bytes are moved through the low 32 bits of a vector.
+ * A 3-byte pixel is put together in a register rather than copied into a
+ * zeroed word in memory, which would stall on the store forwarding.  The
+ * per-pixel kernels are inlined with a constant bpp so the test on it
+ * goes away.  x86 is little-endian, so byte 0 ends up in lane 0.
+ */
+static PNG_GCCRD_INLINE __m128i
+png_gccrd_load_pixel(png_bytep p, png_uint_32 bpp)
+{
+   png_uint_32 v;
+   png_uint_16 lo;
+
+   if (bpp == 4)
+      png_memcpy(&v, p, 4);
+   else
+   {
+      png_memcpy(&lo, p, 2);
+      v = (png_uint_32)lo | ((png_uint_32)p[2] << 16);
+   }
+   return _mm_cvtsi32_si128((int)v);
+}
+
+static PNG_GCCRD_INLINE void
+png_gccrd_store_pixel(png_bytep p, __m128i x, png_uint_32 bpp)
+{
+   png_uint_32 v = (png_uint_32)_mm_cvtsi128_si32(x);
+   png_uint_16 lo = (png_uint_16)v;
+
+   if (bpp == 4)
+      png_memcpy(p, &v, 4);
+   else
+   {
+      png_memcpy(p, &lo, 2);
+      p[2] = (png_byte)(v >> 16);
+   }
+}
+
+/* Finish a Sub row one byte at a time from byte i on. */
+static void
+png_gccrd_sub_tail(png_bytep row, png_uint_32 i, png_uint_32 istop,
+   png_uint_32 bpp)
+{
+   for (; i < istop; i++)
+      row[i] = (png_byte)((row[i] + row[i - bpp]) & 0xff);
+}
+
+static PNG_GCCRD_SSE2 void
+png_read_filter_row_sse2_up(png_row_infop row_info, png_bytep row,
+   png_bytep prev_row)
+{
+   png_uint_32 i = 0;
+   png_uint_32 istop = row_info->rowbytes;
+
+   for (; i + 16 <= istop; i += 16)
+   {
+      __m128i x = _mm_loadu_si128((__m128i *)(row + i));
+      __m128i b = _mm_loadu_si128((__m128i *)(prev_row + i));
+      _mm_storeu_si128((__m128i *)(row + i), _mm_add_epi8(x, b));
+   }
+   for (; i < istop; i++)
+      row[i] = (png_byte)((row[i] + prev_row[i]) & 0xff);
+}
+
+static PNG_GCCRD_AVX2 void
+png_read_filter_row_avx2_up(png_row_infop row_info, png_bytep row,
+   png_bytep prev_row)
+{
+   png_uint_32 i = 0;
+   png_uint_32 istop = row_info->rowbytes;
+
+   for (; i + 32 <= istop; i += 32)
+   {
+      __m256i x = _mm256_loadu_si256((__m256i *)(row + i));
+      __m256i b = _mm256_loadu_si256((__m256i *)(prev_row + i));
+      _mm256_storeu_si256((__m256i *)(row + i), _mm256_add_epi8(x, b));
+   }
+   for (; i < istop; i++)
+      row[i] = (png_byte)((row[i] + prev_row[i]) & 0xff);
+}
+
+/* Sub is a running sum along the row.  Four pixels are loaded at once,
+ * the last pixel of the previous group is added to the first one, and
+ * two shift-and-add steps turn the group into its prefix sum.
+ */
+static PNG_GCCRD_SSE2 void
+png_read_filter_row_sse2_sub(png_row_infop row_info, png_bytep row)
+{
+   png_uint_32 i = 0;
+   png_uint_32 istop = row_info->rowbytes;
+   png_uint_32 bpp = (row_info->pixel_depth + 7) >> 3;
+   __m128i carry = _mm_setzero_si128();
+
+   if (bpp == 4)
+   {
+      for (; i + 16 <= istop; i += 16)
+      {
+         __m128i x = _mm_loadu_si128((__m128i *)(row + i));
+         x = _mm_add_epi8(x, carry);
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+         _mm_storeu_si128((__m128i *)(row + i), x);
+         carry = _mm_srli_si128(x, 12);
+      }
+   }
+   else
+   {
+      __m128i mask = _mm_cvtsi32_si128(0xffffff);
+
+      /* Only 12 of the 16 bytes loaded are used and stored. */
+      for (; i + 16 <= istop; i += 12)
+      {
+         __m128i x = _mm_loadu_si128((__m128i *)(row + i));
+         x = _mm_add_epi8(x, carry);
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+         x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+         _mm_storel_epi64((__m128i *)(row + i), x);
+         png_gccrd_store_pixel(row + i + 8, _mm_srli_si128(x, 8), 4);
+         carry = _mm_and_si128(_mm_srli_si128(x, 9), mask);
+      }
+   }
+   png_gccrd_sub_tail(row, i ? i : bpp, istop, bpp);
+}
+
+/* The AVX2 Sub does two of the SSE2 groups side by side in the two
+ * 128-bit lanes; after the in-lane prefix sum, the last pixel of the low
+ * lane is spread over the high lane and added in.
+ */
+static PNG_GCCRD_AVX2 void
+png_read_filter_row_avx2_sub(png_row_infop row_info, png_bytep row)
+{
+   png_uint_32 i = 0;
+   png_uint_32 istop = row_info->rowbytes;
+   png_uint_32 bpp = (row_info->pixel_depth + 7) >> 3;
+   __m256i carry = _mm256_setzero_si256();
+
+   if (bpp == 4)
+   {
+      for (; i + 32 <= istop; i += 32)
+      {
+         __m256i x = _mm256_loadu_si256((__m256i *)(row + i));
+         __m256i last;
+
+         x = _mm256_add_epi8(x, carry);
+         x = _mm256_add_epi8(x, _mm256_slli_si256(x, 4));
+         x = _mm256_add_epi8(x, _mm256_slli_si256(x, 8));
+         last = _mm256_shuffle_epi32(x, 0xff);
+         x = _mm256_add_epi8(x, _mm256_permute2x128_si256(last, last, 0x08));
+         _mm256_storeu_si256((__m256i *)(row + i), x);
+         carry = _mm256_inserti128_si256(_mm256_setzero_si256(),
+            _mm_srli_si128(_mm256_extracti128_si256(x, 1), 12), 0);
+      }
+   }
+   else
+   {
+      const __m256i spread = _mm256_setr_epi8(
+         9, 10, 11, 9, 10, 11, 9, 10, 11, 9, 10, 11, -1, -1, -1, -1,
+         9, 10, 11, 9, 10, 11, 9, 10, 11, 9, 10, 11, -1, -1, -1, -1);
+      __m128i mask = _mm_cvtsi32_si128(0xffffff);
+
+      /* Two groups of four pixels, at row + i and row + i + 12. */
+      for (; i + 28 <= istop; i += 24)
+      {
+         __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(
+            _mm_loadu_si128((__m128i *)(row + i))),
+            _mm_loadu_si128((__m128i *)(row + i + 12)), 1);
+         __m256i last;
+         __m128i hi;
+
+         x = _mm256_add_epi8(x, carry);
+         x = _mm256_add_epi8(x, _mm256_slli_si256(x, 3));
+         x = _mm256_add_epi8(x, _mm256_slli_si256(x, 6));
+         last = _mm256_shuffle_epi8(x, spread);
+         x = _mm256_add_epi8(x, _mm256_permute2x128_si256(last, last, 0x08));
+         hi = _mm256_extracti128_si256(x, 1);
+         _mm_storel_epi64((__m128i *)(row + i), _mm256_castsi256_si128(x));
+         png_gccrd_store_pixel(row + i + 8,
+            _mm_srli_si128(_mm256_castsi256_si128(x), 8), 4);
+         _mm_storel_epi64((__m128i *)(row + i + 12), hi);
+         png_gccrd_store_pixel(row + i + 20, _mm_srli_si128(hi, 8), 4);
+         carry = _mm256_inserti128_si256(_mm256_setzero_si256(),
+            _mm_and_si128(_mm_srli_si128(hi, 9), mask), 0);
+      }
+   }
+   png_gccrd_sub_tail(row, i ? i : bpp, istop, bpp);
+}
+
+/* Avg adds floor((a + b) / 2).  _mm_avg_epu8 rounds up, so the low bit
+ * of a ^ b is taken off again.  The first pixel has no left neighbour,
+ * which is the same as a == 0.
+ */
+static PNG_GCCRD_INLINE void
+png_gccrd_avg(png_bytep row, png_bytep prev_row, png_uint_32 istop,
+   png_uint_32 bpp)
+{
+   png_uint_32 i;
+   __m128i one = _mm_set1_epi8(1);
+   __m128i a = _mm_setzero_si128();
+
+   for (i = 0; i < istop; i += bpp)
+   {
+      __m128i b = png_gccrd_load_pixel(prev_row + i, bpp);
+      __m128i x = png_gccrd_load_pixel(row + i, bpp);
+      __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b),
+         _mm_and_si128(_mm_xor_si128(a, b), one));
+
+      a = _mm_add_epi8(x, avg);
+      png_gccrd_store_pixel(row + i, a, bpp);
+   }
+}
+
+static PNG_GCCRD_SSE2 void
+png_read_filter_row_sse2_avg(png_row_infop row_info, png_bytep row,
+   png_bytep prev_row)
+{
+   if (row_info->pixel_depth == 32)
+      png_gccrd_avg(row, prev_row, row_info->rowbytes, 4);
+   else
+      png_gccrd_avg(row, prev_row, row_info->rowbytes, 3);
+}
+
+static PNG_GCCRD_INLINE __m128i
+png_gccrd_abs_epi16(__m128i x)
+{
+   return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static PNG_GCCRD_INLINE __m128i
+png_gccrd_select(__m128i m, __m128i t, __m128i e)
+{
+   return _mm_or_si128(_mm_and_si128(m, t), _mm_andnot_si128(m, e));
+}
+
+/* Paeth is done in 16-bit lanes with the same pa/pb/pc terms as the C
+ * code, and ties are broken the same way: a before b before c.  With
+ * a == c == 0 for the first pixel the predictor comes out as b, which is
+ * what the C code does for it explicitly.
+ */
+static PNG_GCCRD_INLINE void
+png_gccrd_paeth(png_bytep row, png_bytep prev_row, png_uint_32 istop,
+   png_uint_32 bpp)
+{
+   png_uint_32 i;
+   __m128i zero = _mm_setzero_si128();
+   __m128i a = zero;
+   __m128i c = zero;
+
+   for (i = 0; i < istop; i += bpp)
+   {
+      __m128i b = _mm_unpacklo_epi8(png_gccrd_load_pixel(prev_row + i, bpp),
+         zero);
+      __m128i x = png_gccrd_load_pixel(row + i, bpp);
+      __m128i p = _mm_sub_epi16(b, c);
+      __m128i pc = _mm_sub_epi16(a, c);
+      __m128i pa = png_gccrd_abs_epi16(p);
+      __m128i pb = png_gccrd_abs_epi16(pc);
+      __m128i smallest, nearest;
+
+      pc = png_gccrd_abs_epi16(_mm_add_epi16(p, pc));
+      smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+      nearest = png_gccrd_select(_mm_cmpeq_epi16(smallest, pa), a,
+         png_gccrd_select(_mm_cmpeq_epi16(smallest, pb), b, c));
+
+      x = _mm_add_epi8(x, _mm_packus_epi16(nearest, nearest));
+      png_gccrd_store_pixel(row + i, x, bpp);
+      a = _mm_unpacklo_epi8(x, zero);
+      c = b;
+   }
+}
+
+static PNG_GCCRD_SSE2 void
+png_read_filter_row_sse2_paeth(png_row_infop row_info, png_bytep row,
+   png_bytep prev_row)
+{
+   if (row_info->pixel_depth == 32)
+      png_gccrd_paeth(row, prev_row, row_info->rowbytes, 4);
+   else
+      png_gccrd_paeth(row, prev_row, row_info->rowbytes, 3);
+}
+
+void
+png_read_filter_row(png_structp png_ptr, png_row_infop row_info, png_bytep
+   row, png_bytep prev_row, int filter)
+{
+   int rgb = row_info->pixel_depth == 24 || row_info->pixel_depth == 32;
+
+   if (png_gccrd_level < 0)
+      png_gccrd_level = png_gccrd_cpu_level();
+
+   png_debug(1, "in png_read_filter_row\n");
+   png_debug2(2,"row = %d, filter = %d\n", png_ptr->row_number, filter);
+
+   if (png_gccrd_level > 0)
+   {
+      switch (filter)
+      {
+         case PNG_FILTER_VALUE_NONE:
+            return;
+         case PNG_FILTER_VALUE_SUB:
+            if (!rgb)
+               break;
+            if (png_gccrd_level > 1)
+               png_read_filter_row_avx2_sub(row_info, row);
+            else
+               png_read_filter_row_sse2_sub(row_info, row);
+            return;
+         case PNG_FILTER_VALUE_UP:
+            if (png_gccrd_level > 1)
+               png_read_filter_row_avx2_up(row_info, row, prev_row);
+            else
+               png_read_filter_row_sse2_up(row_info, row, prev_row);
+            return;
+         case PNG_FILTER_VALUE_AVG:
+            if (!rgb)
+               break;
+            png_read_filter_row_sse2_avg(row_info, row, prev_row);
+            return;
+         case PNG_FILTER_VALUE_PAETH:
+            if (!rgb)
+               break;
+            png_read_filter_row_sse2_paeth(row_info, row, prev_row);
+            return;
+         default:
+            break;
+      }
+   }
+   png_read_filter_row_c(png_ptr, row_info, row, prev_row, filter);
+}
+
+#endif /* PNG_ASSEMBLER_CODE_SUPPORTED && PNG_USE_PNGGCCRD */
@@ -439,47 +439,63 @@ png_push_fill_buffer(png_structp png_ptr, png_bytep buffer, png_size_t length)
    }
 }
 
+/* Keep the data not yet used until more arrives.  The saved data stays
+ * where it is as long as the new data fits behind it; otherwise it is
+ * moved to the front, or, if that would leave less than half of the
+ * buffer free, copied to a new buffer twice the size needed.  That way
+ * each byte is copied a bounded number of times however small the
+ * pieces are that png_process_data() is given.
+ */
 void
 png_push_save_buffer(png_structp png_ptr)
 {
-   if (png_ptr->save_buffer_size)
-   {
-      if (png_ptr->save_buffer_ptr != png_ptr->save_buffer)
-      {
-         png_size_t i,istop;
-         png_bytep sp;
-         png_bytep dp;
-
-         istop = png_ptr->save_buffer_size;
-         for (i = 0, sp = png_ptr->save_buffer_ptr, dp = png_ptr->save_buffer;
-            i < istop; i++, sp++, dp++)
-         {
-            *dp = *sp;
-         }
-      }
-   }
-   if (png_ptr->save_buffer_size + png_ptr->current_buffer_size >
-      png_ptr->save_buffer_max)
+   png_size_t needed;
+
+   if (png_ptr->save_buffer_size == 0)
+      png_ptr->save_buffer_ptr = png_ptr->save_buffer;
+   needed = png_ptr->save_buffer_size + png_ptr->current_buffer_size;
+   if (needed > png_ptr->save_buffer_max / 2 &&
+      needed > png_ptr->save_buffer_max - (png_size_t)
+      (png_ptr->save_buffer_ptr - png_ptr->save_buffer))
    {
       png_size_t new_max;
       png_bytep old_buffer;
 
-      new_max = png_ptr->save_buffer_size + png_ptr->current_buffer_size + 256;
+      new_max = 2 * needed;
+      if (new_max < 256)
+         new_max = 256;
       old_buffer = png_ptr->save_buffer;
       png_ptr->save_buffer = (png_bytep)png_malloc(png_ptr,
          (png_uint_32)new_max);
-      png_memcpy(png_ptr->save_buffer, old_buffer, png_ptr->save_buffer_size);
+      if (png_ptr->save_buffer_size)
+         png_memcpy(png_ptr->save_buffer, png_ptr->save_buffer_ptr,
+            png_ptr->save_buffer_size);
       png_free(png_ptr, old_buffer);
       png_ptr->save_buffer_max = new_max;
+      png_ptr->save_buffer_ptr = png_ptr->save_buffer;
+   }
+   else if (needed > png_ptr->save_buffer_max - (png_size_t)
+      (png_ptr->save_buffer_ptr - png_ptr->save_buffer))
+   {
+      png_size_t i,istop;
+      png_bytep sp;
+      png_bytep dp;
+
+      istop = png_ptr->save_buffer_size;
+      for (i = 0, sp = png_ptr->save_buffer_ptr, dp = png_ptr->save_buffer;
+         i < istop; i++, sp++, dp++)
+      {
+         *dp = *sp;
+      }
+      png_ptr->save_buffer_ptr = png_ptr->save_buffer;
    }
    if (png_ptr->current_buffer_size)
    {
-      png_memcpy(png_ptr->save_buffer + png_ptr->save_buffer_size,
+      png_memcpy(png_ptr->save_buffer_ptr + png_ptr->save_buffer_size,
          png_ptr->current_buffer_ptr, png_ptr->current_buffer_size);
       png_ptr->save_buffer_size += png_ptr->current_buffer_size;
       png_ptr->current_buffer_size = 0;
    }
-   png_ptr->save_buffer_ptr = png_ptr->save_buffer;
    png_ptr->buffer_size = 0;
 }
 
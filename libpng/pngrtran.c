@@ -15,6 +15,9 @@
 
 #define PNG_INTERNAL
 #include "png.h"
+#if defined(PNG_READ_FUSED_TRANSFORMS_SUPPORTED) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /* Set the action on getting a CRC error for an ancillary or critical chunk. */
 void
@@ -639,6 +642,369 @@ png_set_read_user_transform_fn(png_structp png_ptr, png_user_transform_ptr
 }
 #endif
 
+#if defined(PNG_READ_FUSED_TRANSFORMS_SUPPORTED)
+/* Most readers ask for nothing more than expand, 16-to-8 and gamma.
+ * png_do_read_transformations() does those in up to four passes over
+ * the row (unpack, expand, gamma, chop), each one switching on the
+ * color type and bit depth again.  When no other transformation is set,
+ * png_init_read_fused() picks one of the kernels below instead, which
+ * reads the unfiltered row once and writes the final pixels.  The
+ * results are the same byte for byte; the table of the gray kernel is
+ * filled by running the ordinary transformations over every possible
+ * gray value.
+ */
+#define PNG_FUSED_NONE     0
+#define PNG_FUSED_PALETTE  1  /* packed palette to RGB or RGBA */
+#define PNG_FUSED_GRAY     2  /* gray of 1 to 8 bits to gray or gray-alpha */
+#define PNG_FUSED_RGB_TRNS 3  /* 8-bit RGB with tRNS and gamma to RGBA */
+#define PNG_FUSED_16_TO_8  4  /* 16-bit samples to 8 bits */
+
+#define PNG_FUSED_TRANSFORMS \
+   (PNG_EXPAND | PNG_16_TO_8 | PNG_GAMMA | PNG_INTERLACE)
+
+static void
+png_init_read_fused(png_structp png_ptr)
+{
+   png_uint_32 transformations = png_ptr->transformations;
+   int color_type = png_ptr->color_type;
+   int bit_depth = png_ptr->bit_depth;
+   int kernel = PNG_FUSED_NONE;
+   int gamma;
+
+   png_debug(1, "in png_init_read_fused\n");
+   png_ptr->fused_transform = PNG_FUSED_NONE;
+   if (transformations & ~PNG_FUSED_TRANSFORMS)
+      return;
+
+   /* Only where the ordinary transformations take more than one pass */
+   gamma = (transformations & PNG_GAMMA) && png_ptr->gamma_table != NULL;
+   if (color_type == PNG_COLOR_TYPE_PALETTE)
+   {
+      if ((transformations & PNG_EXPAND) && bit_depth < 8)
+         kernel = PNG_FUSED_PALETTE;
+   }
+   else if (bit_depth == 16)
+   {
+#if !defined(PNG_READ_16_TO_8_ACCURATE_SCALE_SUPPORTED)
+      if (transformations & PNG_16_TO_8)
+         kernel = PNG_FUSED_16_TO_8;
+#endif
+   }
+   else if (color_type == PNG_COLOR_TYPE_GRAY)
+   {
+      if ((transformations & PNG_EXPAND) &&
+          (png_ptr->num_trans || gamma) &&
+          (bit_depth < 8 || (png_ptr->num_trans && gamma)))
+         kernel = PNG_FUSED_GRAY;
+   }
+   else if (color_type == PNG_COLOR_TYPE_RGB)
+   {
+      if ((transformations & PNG_EXPAND) && png_ptr->num_trans && gamma)
+         kernel = PNG_FUSED_RGB_TRNS;
+   }
+
+   if (kernel == PNG_FUSED_NONE)
+      return;
+
+   if (kernel != PNG_FUSED_16_TO_8 && kernel != PNG_FUSED_RGB_TRNS)
+   {
+      int i, num;
+
+      if (png_ptr->fused_table == NULL)
+         png_ptr->fused_table = (png_bytep)png_malloc(png_ptr,
+            (png_uint_32)1024);
+
+      if (kernel == PNG_FUSED_PALETTE)
+      {
+         /* The palette is already gamma corrected.  Indexes past the end
+          * of the palette have no defined color; they come out black.
+          */
+         png_bytep tp = png_ptr->fused_table;
+
+         png_memset(tp, 0, 1024);
+         for (i = 0; i < 256; i++, tp += 4)
+         {
+            if (i < (int)png_ptr->num_palette)
+            {
+               tp[0] = png_ptr->palette[i].red;
+               tp[1] = png_ptr->palette[i].green;
+               tp[2] = png_ptr->palette[i].blue;
+            }
+            if (png_ptr->trans != NULL && i < (int)png_ptr->num_trans)
+               tp[3] = png_ptr->trans[i];
+            else
+               tp[3] = 0xff;
+         }
+      }
+      else
+      {
+         /* Gray and alpha of each gray value, as png_do_expand() and
+          * png_do_gamma() would leave them.
+          */
+         num = 1 << bit_depth;
+         for (i = 0; i < num; i++)
+         {
+            png_row_info info;
+            png_byte pixel[2];
+
+            info.width = 1;
+            info.color_type = PNG_COLOR_TYPE_GRAY;
+            info.bit_depth = (png_byte)bit_depth;
+            info.channels = 1;
+            info.pixel_depth = (png_byte)bit_depth;
+            info.rowbytes = 1;
+            pixel[0] = (png_byte)(i << (8 - bit_depth));
+            pixel[1] = 0xff;
+            png_do_expand(&info, pixel,
+               png_ptr->num_trans ? &(png_ptr->trans_values) : NULL);
+            if (transformations & PNG_GAMMA)
+               png_do_gamma(&info, pixel, png_ptr->gamma_table,
+                  png_ptr->gamma_16_table, png_ptr->gamma_shift);
+            png_ptr->fused_table[2 * i] = pixel[0];
+            png_ptr->fused_table[2 * i + 1] = pixel[1];
+         }
+      }
+   }
+   png_ptr->fused_transform = (png_byte)kernel;
+}
+
+/* Expand a row of palette indexes or gray values of 1 to 8 bits through
+ * the table made by png_init_read_fused(), working from the end of the
+ * row as the result is wider than the packed samples.  The table has
+ * four bytes (RGBA) per palette entry and two (gray, alpha) per gray
+ * value.
+ */
+static void
+png_do_fused_lookup(png_row_infop row_info, png_bytep row,
+   png_bytep table, int channels)
+{
+   png_uint_32 row_width = row_info->width;
+   int depth = row_info->bit_depth;
+   int mask = (1 << depth) - 1;
+   int first = 8 - depth;
+   png_uint_32 last = (row_width - 1) * depth;
+   png_bytep sp = row + (png_size_t)(last >> 3);
+   png_bytep dp = row + (png_size_t)row_width * channels;
+   int shift = first - (int)(last & 7);
+   int value;
+   png_uint_32 i;
+
+   for (i = 0; i < row_width; i++)
+   {
+      if (depth == 8)
+         value = *sp--;
+      else
+      {
+         value = (*sp >> shift) & mask;
+         if (shift == first)
+         {
+            shift = 0;
+            sp--;
+         }
+         else
+            shift += depth;
+      }
+
+      switch (channels)
+      {
+         case 1:
+            *--dp = table[value << 1];
+            break;
+         case 2:
+            dp -= 2;
+            dp[0] = table[value << 1];
+            dp[1] = table[(value << 1) + 1];
+            break;
+         case 3:
+            dp -= 3;
+            dp[0] = table[value << 2];
+            dp[1] = table[(value << 2) + 1];
+            dp[2] = table[(value << 2) + 2];
+            break;
+         default:
+            dp -= 4;
+            png_memcpy(dp, table + (value << 2), 4);
+            break;
+      }
+   }
+
+   row_info->color_type = (png_byte)((channels > 2 ? PNG_COLOR_MASK_COLOR :
+      0) | ((channels & 1) ? 0 : PNG_COLOR_MASK_ALPHA));
+   row_info->channels = (png_byte)channels;
+   row_info->bit_depth = 8;
+   row_info->pixel_depth = (png_byte)(channels << 3);
+   row_info->rowbytes = row_width * channels;
+}
+
+/* 8-bit RGB with a tRNS color to RGBA, gamma correcting the colors */
+static void
+png_do_fused_rgb_trns(png_row_infop row_info, png_bytep row,
+   png_color_16p trans_value, png_bytep gamma_table)
+{
+   png_uint_32 row_width = row_info->width;
+   png_bytep sp = row + (png_size_t)row_width * 3;
+   png_bytep dp = row + (png_size_t)row_width * 4;
+   png_uint_32 i;
+
+   for (i = 0; i < row_width; i++)
+   {
+      sp -= 3;
+      dp -= 4;
+      dp[3] = (png_byte)((sp[0] == trans_value->red &&
+         sp[1] == trans_value->green &&
+         sp[2] == trans_value->blue) ? 0 : 0xff);
+      dp[2] = gamma_table[sp[2]];
+      dp[1] = gamma_table[sp[1]];
+      dp[0] = gamma_table[sp[0]];
+   }
+
+   row_info->color_type = PNG_COLOR_TYPE_RGB_ALPHA;
+   row_info->channels = 4;
+   row_info->pixel_depth = 32;
+   row_info->rowbytes = row_width * 4;
+}
+
+/* 16-bit samples to 8 bits, gamma correcting the colors and turning a
+ * tRNS color into an alpha channel on the way.  The row shrinks, so this
+ * works from the start of the row.
+ */
+static void
+png_do_fused_16_to_8(png_row_infop row_info, png_bytep row,
+   png_color_16p trans_value, png_uint_16pp gamma_16_table, int gamma_shift)
+{
+   png_uint_32 row_width = row_info->width;
+   int colors = (row_info->color_type & PNG_COLOR_MASK_COLOR) ? 3 : 1;
+   int alpha = (row_info->color_type & PNG_COLOR_MASK_ALPHA) != 0;
+   png_bytep sp = row;
+   png_bytep dp = row;
+   png_uint_32 i;
+   int c;
+
+   if (alpha)
+      trans_value = NULL;
+
+   if (trans_value == NULL && gamma_16_table == NULL)
+   {
+      /* Just the high bytes */
+      png_uint_32 n = row_width * (colors + alpha);
+
+      i = 0;
+#if defined(__SSE2__)
+      {
+         __m128i low = _mm_set1_epi16(0xff);
+
+         for (; i + 16 <= n; i += 16, sp += 32, dp += 16)
+         {
+            __m128i a = _mm_loadu_si128((__m128i *)sp);
+            __m128i b = _mm_loadu_si128((__m128i *)(sp + 16));
+
+            _mm_storeu_si128((__m128i *)dp,
+               _mm_packus_epi16(_mm_and_si128(a, low),
+               _mm_and_si128(b, low)));
+         }
+      }
+#endif
+      for (; i < n; i++, sp += 2)
+         *dp++ = *sp;
+   }
+   else if (trans_value == NULL && !alpha)
+   {
+      png_uint_32 n = row_width * colors;
+
+      for (i = 0; i < n; i++, sp += 2)
+         *dp++ = (png_byte)(gamma_16_table[sp[1] >> gamma_shift][sp[0]] >> 8);
+   }
+   else if (alpha)
+   {
+      for (i = 0; i < row_width; i++)
+      {
+         for (c = 0; c < colors; c++, sp += 2)
+            *dp++ = (png_byte)(gamma_16_table[sp[1] >> gamma_shift][sp[0]]
+               >> 8);
+         *dp++ = *sp;
+         sp += 2;
+      }
+   }
+   else
+   {
+      /* The tRNS color as it appears in the row */
+      png_byte key[6];
+      png_byte a;
+
+      key[0] = (png_byte)(trans_value->red >> 8);
+      key[1] = (png_byte)(trans_value->red & 0xff);
+      key[2] = (png_byte)(trans_value->green >> 8);
+      key[3] = (png_byte)(trans_value->green & 0xff);
+      key[4] = (png_byte)(trans_value->blue >> 8);
+      key[5] = (png_byte)(trans_value->blue & 0xff);
+      if (colors == 1)
+      {
+         key[0] = (png_byte)(trans_value->gray >> 8);
+         key[1] = (png_byte)(trans_value->gray & 0xff);
+      }
+
+      for (i = 0; i < row_width; i++)
+      {
+         if (colors == 1)
+            a = (png_byte)((sp[0] == key[0] && sp[1] == key[1]) ? 0 : 0xff);
+         else
+            a = (png_byte)((sp[0] == key[0] && sp[1] == key[1] &&
+               sp[2] == key[2] && sp[3] == key[3] &&
+               sp[4] == key[4] && sp[5] == key[5]) ? 0 : 0xff);
+         if (gamma_16_table != NULL)
+         {
+            for (c = 0; c < colors; c++, sp += 2)
+               *dp++ = (png_byte)(gamma_16_table[sp[1] >> gamma_shift]
+                  [sp[0]] >> 8);
+         }
+         else
+         {
+            for (c = 0; c < colors; c++, sp += 2)
+               *dp++ = *sp;
+         }
+         *dp++ = a;
+      }
+      row_info->color_type |= PNG_COLOR_MASK_ALPHA;
+      alpha = 1;
+   }
+
+   row_info->channels = (png_byte)(colors + alpha);
+   row_info->bit_depth = 8;
+   row_info->pixel_depth = (png_byte)(row_info->channels << 3);
+   row_info->rowbytes = row_width * row_info->channels;
+}
+
+static void
+png_do_read_fused(png_structp png_ptr)
+{
+   png_row_infop row_info = &(png_ptr->row_info);
+   png_bytep row = png_ptr->row_buf + 1;
+   int gamma = (png_ptr->transformations & PNG_GAMMA) != 0;
+
+   switch (png_ptr->fused_transform)
+   {
+      case PNG_FUSED_PALETTE:
+         png_do_fused_lookup(row_info, row, png_ptr->fused_table,
+            png_ptr->trans != NULL ? 4 : 3);
+         break;
+      case PNG_FUSED_GRAY:
+         png_do_fused_lookup(row_info, row, png_ptr->fused_table,
+            png_ptr->num_trans ? 2 : 1);
+         break;
+      case PNG_FUSED_RGB_TRNS:
+         png_do_fused_rgb_trns(row_info, row, &(png_ptr->trans_values),
+            png_ptr->gamma_table);
+         break;
+      case PNG_FUSED_16_TO_8:
+         png_do_fused_16_to_8(row_info, row,
+            ((png_ptr->transformations & PNG_EXPAND) && png_ptr->num_trans) ?
+            &(png_ptr->trans_values) : NULL,
+            gamma ? png_ptr->gamma_16_table : NULL, png_ptr->gamma_shift);
+         break;
+   }
+}
+#endif /* PNG_READ_FUSED_TRANSFORMS_SUPPORTED */
+
 /* Initialize everything needed for the read.  This includes modifying
  * the palette.
  */
@@ -953,6 +1319,10 @@ png_init_read_transformations(png_structp png_ptr)
       }
    }
 #endif
+
+#if defined(PNG_READ_FUSED_TRANSFORMS_SUPPORTED)
+   png_init_read_fused(png_ptr);
+#endif
  }
 }
 
@@ -1095,6 +1465,14 @@ png_do_read_transformations(png_structp png_ptr)
    }
 #endif
 
+#if defined(PNG_READ_FUSED_TRANSFORMS_SUPPORTED)
+   if (png_ptr->fused_transform != PNG_FUSED_NONE)
+   {
+      png_do_read_fused(png_ptr);
+      return;
+   }
+#endif
+
 #if defined(PNG_READ_EXPAND_SUPPORTED)
    if (png_ptr->transformations & PNG_EXPAND)
    {
@@ -3768,6 +4146,225 @@ png_do_dither(png_row_infop row_info, png_bytep row,
 static int png_gamma_shift[] =
    {0x10, 0x21, 0x42, 0x84, 0x110, 0x248, 0x550, 0xff0};
 
+/* Number of insignificant bits dropped from 16-bit samples before they
+ * index the 16-bit gamma tables.
+ */
+static int
+png_gamma_16_shift(png_structp png_ptr)
+{
+   int sig_bit, shift;
+
+   if (png_ptr->color_type & PNG_COLOR_MASK_COLOR)
+   {
+      sig_bit = (int)png_ptr->sig_bit.red;
+      if ((int)png_ptr->sig_bit.green > sig_bit)
+         sig_bit = png_ptr->sig_bit.green;
+      if ((int)png_ptr->sig_bit.blue > sig_bit)
+         sig_bit = png_ptr->sig_bit.blue;
+   }
+   else
+   {
+      sig_bit = (int)png_ptr->sig_bit.gray;
+   }
+
+   if (sig_bit > 0)
+      shift = 16 - sig_bit;
+   else
+      shift = 0;
+
+   if (png_ptr->transformations & PNG_16_TO_8)
+   {
+      if (shift < (16 - PNG_MAX_GAMMA_8))
+         shift = (16 - PNG_MAX_GAMMA_8);
+   }
+
+   if (shift > 8)
+      shift = 8;
+   if (shift < 0)
+      shift = 0;
+
+   return shift;
+}
+
+#if defined(PNG_READ_GAMMA_CACHE_SUPPORTED)
+/* The gamma tables depend only on the two gammas, on 8 or 16 bits and
+ * the 16-bit shift, and on three transformations: background and
+ * rgb-to-gray need the extra to_1/from_1 tables, and 16-to-8 changes
+ * how the 16-bit table is filled.  Copies of the tables for the first
+ * PNG_GAMMA_CACHE_SIZE such combinations are kept for the life of the
+ * process and shared read-only by every png_struct that needs them, so
+ * the pow() calls are made once per combination instead of once per
+ * image.  png_read_destroy() leaves shared tables alone
+ * (PNG_FLAG_SHARED_GAMMA).
+ *
+ * Each entry is one malloc() block, filled in completely before it is
+ * pushed onto the list with an atomic compare-and-swap, and never
+ * changed or freed afterwards; so any number of threads may look up and
+ * insert at once without a lock.
+ */
+#define PNG_GAMMA_CACHE_TRANSFORMS \
+   (PNG_16_TO_8 | PNG_BACKGROUND | PNG_RGB_TO_GRAY)
+
+typedef struct png_gamma_cache_struct
+{
+   struct png_gamma_cache_struct *next;
+   double gamma;
+   double screen_gamma;
+   int wide;                  /* built for bit depth 16 */
+   int shift;
+   png_uint_32 transformations;
+   png_bytep gamma_table;
+   png_bytep gamma_from_1;
+   png_bytep gamma_to_1;
+   png_uint_16pp gamma_16_table;
+   png_uint_16pp gamma_16_from_1;
+   png_uint_16pp gamma_16_to_1;
+} png_gamma_cache;
+
+static png_gamma_cache *png_gamma_cache_list = NULL;
+static int png_gamma_cache_count = 0;
+
+static int
+png_gamma_cache_lookup(png_structp png_ptr)
+{
+   png_gamma_cache *p;
+   int wide = png_ptr->bit_depth > 8;
+   int shift = wide ? png_gamma_16_shift(png_ptr) : 0;
+   png_uint_32 transformations =
+      png_ptr->transformations & PNG_GAMMA_CACHE_TRANSFORMS;
+
+   for (p = __atomic_load_n(&png_gamma_cache_list, __ATOMIC_ACQUIRE);
+        p != NULL; p = p->next)
+   {
+      if (p->gamma == png_ptr->gamma &&
+          p->screen_gamma == png_ptr->screen_gamma &&
+          p->wide == wide && p->shift == shift &&
+          p->transformations == transformations)
+      {
+         png_ptr->gamma_table = p->gamma_table;
+         png_ptr->gamma_from_1 = p->gamma_from_1;
+         png_ptr->gamma_to_1 = p->gamma_to_1;
+         png_ptr->gamma_16_table = p->gamma_16_table;
+         png_ptr->gamma_16_from_1 = p->gamma_16_from_1;
+         png_ptr->gamma_16_to_1 = p->gamma_16_to_1;
+         png_ptr->gamma_shift = (png_byte)shift;
+         png_ptr->flags |= PNG_FLAG_SHARED_GAMMA;
+         return 1;
+      }
+   }
+   return 0;
+}
+
+/* Copy an 8-bit table to *next, moving *next past it */
+static png_bytep
+png_gamma_cache_copy_8(png_bytep table, png_bytep *next)
+{
+   png_bytep copy = *next;
+
+   if (table == NULL)
+      return (NULL);
+   png_memcpy(copy, table, 256);
+   *next += 256;
+   return (copy);
+}
+
+/* Copy a 16-bit table of num rows: the row pointers go to *index and the
+ * rows to *rows, both of which are moved past them.
+ */
+static png_uint_16pp
+png_gamma_cache_copy_16(png_uint_16pp table, int num, png_uint_16pp *index,
+   png_uint_16p *rows)
+{
+   png_uint_16pp copy = *index;
+   int i;
+
+   if (table == NULL)
+      return (NULL);
+   for (i = 0; i < num; i++)
+   {
+      copy[i] = *rows;
+      png_memcpy(copy[i], table[i], 256 * sizeof (png_uint_16));
+      *rows += 256;
+   }
+   *index += num;
+   return (copy);
+}
+
+/* Keep a copy of the tables png_ptr has just built, if there is room in
+ * the cache and memory for the copy; the png_struct keeps its own
+ * tables either way, so nothing here can fail the read.
+ */
+static void
+png_gamma_cache_insert(png_structp png_ptr)
+{
+   png_gamma_cache *p;
+   png_size_t size;
+   png_uint_16pp index;
+   png_uint_16p rows;
+   png_bytep bytes;
+   int num = 0, tables = 0;
+
+   if (__atomic_load_n(&png_gamma_cache_count, __ATOMIC_RELAXED) >=
+       PNG_GAMMA_CACHE_SIZE)
+      return;
+   if (__atomic_add_fetch(&png_gamma_cache_count, 1, __ATOMIC_RELAXED) >
+       PNG_GAMMA_CACHE_SIZE)
+      return;
+
+   if (png_ptr->bit_depth > 8)
+   {
+      num = 1 << (8 - png_ptr->gamma_shift);
+      tables = (png_ptr->gamma_16_table != NULL) +
+         (png_ptr->gamma_16_from_1 != NULL) +
+         (png_ptr->gamma_16_to_1 != NULL);
+      size = sizeof (png_gamma_cache) +
+         tables * num * (sizeof (png_uint_16p) + 256 * sizeof (png_uint_16));
+   }
+   else
+   {
+      tables = (png_ptr->gamma_table != NULL) +
+         (png_ptr->gamma_from_1 != NULL) + (png_ptr->gamma_to_1 != NULL);
+      size = sizeof (png_gamma_cache) + tables * 256;
+   }
+
+   p = (png_gamma_cache *)malloc(size);
+   if (p == NULL)
+   {
+      __atomic_sub_fetch(&png_gamma_cache_count, 1, __ATOMIC_RELAXED);
+      return;
+   }
+   png_memset(p, 0, sizeof (png_gamma_cache));
+   p->gamma = png_ptr->gamma;
+   p->screen_gamma = png_ptr->screen_gamma;
+   p->wide = png_ptr->bit_depth > 8;
+   p->shift = p->wide ? png_ptr->gamma_shift : 0;
+   p->transformations = png_ptr->transformations & PNG_GAMMA_CACHE_TRANSFORMS;
+   if (p->wide)
+   {
+      index = (png_uint_16pp)(p + 1);
+      rows = (png_uint_16p)(index + tables * num);
+      p->gamma_16_table = png_gamma_cache_copy_16(png_ptr->gamma_16_table,
+         num, &index, &rows);
+      p->gamma_16_from_1 = png_gamma_cache_copy_16(png_ptr->gamma_16_from_1,
+         num, &index, &rows);
+      p->gamma_16_to_1 = png_gamma_cache_copy_16(png_ptr->gamma_16_to_1,
+         num, &index, &rows);
+   }
+   else
+   {
+      bytes = (png_bytep)(p + 1);
+      p->gamma_table = png_gamma_cache_copy_8(png_ptr->gamma_table, &bytes);
+      p->gamma_from_1 = png_gamma_cache_copy_8(png_ptr->gamma_from_1, &bytes);
+      p->gamma_to_1 = png_gamma_cache_copy_8(png_ptr->gamma_to_1, &bytes);
+   }
+
+   p->next = __atomic_load_n(&png_gamma_cache_list, __ATOMIC_RELAXED);
+   while (!__atomic_compare_exchange_n(&png_gamma_cache_list, &p->next, p,
+      0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      /* p->next now holds the new head */ ;
+}
+#endif /* PNG_READ_GAMMA_CACHE_SUPPORTED */
+
 /* We build the 8- or 16-bit gamma tables here.  Note that for 16-bit
  * tables, we don't make a full table if we are reducing to 8-bit in
  * the future.  Note also how the gamma_16 tables are segmented so that
@@ -3779,6 +4376,10 @@ png_build_gamma_table(png_structp png_ptr)
   png_debug(1, "in png_build_gamma_table\n");
   if(png_ptr->gamma != 0.0)
   {
+#if defined(PNG_READ_GAMMA_CACHE_SUPPORTED)
+   if (png_gamma_cache_lookup(png_ptr))
+      return;
+#endif
    if (png_ptr->bit_depth <= 8)
    {
       int i;
@@ -3836,38 +4437,9 @@ png_build_gamma_table(png_structp png_ptr)
    {
       double g;
       int i, j, shift, num;
-      int sig_bit;
       png_uint_32 ig;
 
-      if (png_ptr->color_type & PNG_COLOR_MASK_COLOR)
-      {
-         sig_bit = (int)png_ptr->sig_bit.red;
-         if ((int)png_ptr->sig_bit.green > sig_bit)
-            sig_bit = png_ptr->sig_bit.green;
-         if ((int)png_ptr->sig_bit.blue > sig_bit)
-            sig_bit = png_ptr->sig_bit.blue;
-      }
-      else
-      {
-         sig_bit = (int)png_ptr->sig_bit.gray;
-      }
-
-      if (sig_bit > 0)
-         shift = 16 - sig_bit;
-      else
-         shift = 0;
-
-      if (png_ptr->transformations & PNG_16_TO_8)
-      {
-         if (shift < (16 - PNG_MAX_GAMMA_8))
-            shift = (16 - PNG_MAX_GAMMA_8);
-      }
-
-      if (shift > 8)
-         shift = 8;
-      if (shift < 0)
-         shift = 0;
-
+      shift = png_gamma_16_shift(png_ptr);
       png_ptr->gamma_shift = (png_byte)shift;
 
       num = (1 << (8 - shift));
@@ -3980,6 +4552,9 @@ png_build_gamma_table(png_structp png_ptr)
       }
 #endif /* PNG_READ_BACKGROUND_SUPPORTED || PNG_RGB_TO_GRAY_SUPPORTED */
    }
+#if defined(PNG_READ_GAMMA_CACHE_SUPPORTED)
+   png_gamma_cache_insert(png_ptr);
+#endif
  }
 }
 #endif
@@ -389,3 +389,16 @@ png_permit_empty_plte (png_structp png_ptr, int empty_plte_permitted)
    png_ptr->empty_plte_permitted=(png_byte)empty_plte_permitted;
 }
 #endif
+
+void
+png_set_compression_buffer_size(png_structp png_ptr, png_uint_32 size)
+{
+   png_debug(1, "in png_set_compression_buffer_size\n");
+   if (png_ptr == NULL || size == 0)
+      return;
+   png_free(png_ptr, png_ptr->zbuf);
+   png_ptr->zbuf_size = (png_size_t)size;
+   png_ptr->zbuf = (png_bytep)png_malloc(png_ptr, size);
+   png_ptr->zstream.next_out = png_ptr->zbuf;
+   png_ptr->zstream.avail_out = (uInt)png_ptr->zbuf_size;
+}
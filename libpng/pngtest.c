@@ -477,7 +477,7 @@ png_debug_free(png_structp png_ptr, png_voidp ptr)
             break;
          }
          if (pinfo->next == NULL) {
-            fprintf(STDERR, "Pointer %x not found\n", ptr);
+            fprintf(STDERR, "Pointer %p not found\n", ptr);
             break;
          }
          ppinfo = &pinfo->next;
@@ -1069,7 +1069,8 @@ main(int argc, char *argv[])
             fprintf(STDERR, "MEMORY ERROR: %d bytes still allocated\n",
                current_allocation);
             while (pinfo != NULL) {
-               fprintf(STDERR, " %d bytes at %x\n", pinfo->size, pinfo->pointer);
+               fprintf(STDERR, " %lu bytes at %p\n",
+                  (unsigned long)pinfo->size, pinfo->pointer);
                pinfo = pinfo->next;
                }
          }
@@ -1134,7 +1135,8 @@ main(int argc, char *argv[])
              fprintf(STDERR, "MEMORY ERROR: %d bytes still allocated\n",
                 current_allocation);
              while (pinfo != NULL) {
-                fprintf(STDERR, " %d bytes at %x\n", pinfo->size, pinfo->pointer);
+                fprintf(STDERR, " %lu bytes at %p\n",
+                   (unsigned long)pinfo->size, pinfo->pointer);
                 pinfo = pinfo->next;
              }
           }
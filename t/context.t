@@ -0,0 +1,55 @@
+#!perl
+BEGIN
+{
+ $| = 1;
+ print "1..5\n";
+}
+use Tk;
+use Tk::PNG;
+use MIME::Base64;
+print "ok 1\n";
+my $mw = MainWindow->new;
+my $ref = $mw->Photo(-format => "png", -file => "pngtest.png");
+my $png = Tk::PNG::Context->new;
+print "not " unless $png;
+print "ok 2\n";
+my $expect = $ref->data(-format => 'png');
+my $ok = 1;
+for (1..3)
+ {
+  my $img = $mw->Photo;
+  $png->read($img, -file => "pngtest.png");
+  $ok = 0 unless $img->data(-format => 'png') eq $expect;
+  $img->delete;
+ }
+print "not " unless $ok;
+print "ok 3\n";
+my $img = $mw->Photo;
+$png->read($img, -data => $png->data($ref));
+print "not " unless $img->data(-format => 'png') eq $expect;
+print "ok 4\n";
+# Like ->data, the context writes opaque photos without alpha and gray
+# ones as gray.
+my $ok = 1;
+for my $gray (0, 1)
+ {
+  my $photo = $mw->Photo(-width => 20, -height => 10);
+  for my $y (0..9)
+   {
+    for my $x (0..19)
+     {
+      my @rgb = $gray ? ((12*$x) x 3) : (12*$x, 25*$y, 255-12*$x);
+      $photo->put(sprintf('#%02x%02x%02x', @rgb), -to => $x, $y);
+     }
+   }
+  my $data = $png->data($photo);
+  my $type = Tk::PNG::info(decode_base64($data))->{color_type};
+  $ok = 0 unless $type == ($gray ? 0 : 2) && $type ==
+      Tk::PNG::info(decode_base64($photo->data(-format => 'png')))->{color_type};
+  my $img = $mw->Photo;
+  $png->read($img, -data => $data);
+  $ok = 0 unless $img->data(-format => 'png') eq $photo->data(-format => 'png');
+  $_->delete for ($img, $photo);
+ }
+print "not " unless $ok;
+print "ok 5\n";
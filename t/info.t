@@ -0,0 +1,25 @@
+#!perl
+BEGIN
+{
+ $| = 1;
+ print "1..5\n";
+}
+use Tk::PNG;
+print "ok 1\n";
+my $info = Tk::PNG::info("pngtest.png");
+print "not " unless $info->{width} == 91 && $info->{height} == 69 &&
+                    $info->{bit_depth} == 8 && $info->{color_type} == 6;
+print "ok 2\n";
+print "not " unless abs($info->{gamma} - 0.45455) < 1e-6 &&
+                    join(',',@{$info->{phys}}) eq '2834,2834,1' &&
+                    $info->{time} eq '1996-06-07 17:58:08';
+print "ok 3\n";
+print "not " unless join(',',@{$info->{text}}) eq 'Title,Description';
+print "ok 4\n";
+open(my $fh, "<", "pngtest.png") || die "Cannot open pngtest.png:$!";
+binmode($fh);
+my $data = do { local $/; <$fh> };
+close($fh);
+my $same = Tk::PNG::info($data);
+print "not " unless $same->{width} == 91 && $same->{time} eq $info->{time};
+print "ok 5\n";
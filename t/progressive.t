@@ -0,0 +1,28 @@
+#!perl
+BEGIN
+{
+ $| = 1;
+ print "1..4\n";
+}
+use Tk;
+use Tk::PNG;
+print "ok 1\n";
+my $mw = MainWindow->new;
+my $ref = $mw->Photo(-format => "png", -file => "pngtest.png");
+my $img = $mw->Photo;
+open(my $fh, "<", "pngtest.png") || die "Cannot open pngtest.png:$!";
+binmode($fh);
+my $decoder = Tk::PNG::Progressive->new($img);
+print "not " unless $decoder;
+print "ok 2\n";
+my $done = 0;
+while (!$done && read($fh, my $buf, 100))
+ {
+  $done = $decoder->feed($buf);
+ }
+close($fh);
+print "not " unless $done;
+print "ok 3\n";
+my $same = ($img->data(-format => 'png') eq $ref->data(-format => 'png'));
+print "not " unless $same;
+print "ok 4\n";
@@ -0,0 +1,208 @@
+#!perl
+BEGIN
+{
+ $| = 1;
+ print "1..11\n";
+}
+use Tk;
+use Tk::PNG;
+use MIME::Base64;
+use Compress::Zlib;
+print "ok 1\n";
+my $mw = MainWindow->new;
+
+# Interlaced images 1 to 4 pixels wide have Adam7 passes without pixels.
+# The first pass repeats the top left pixel over the image, and six
+# passes leave out only the odd rows.
+my $ok = 1;
+for my $w (1..4)
+ {
+  my $src = $mw->Photo(-width => $w, -height => 8);
+  for my $y (0..7)
+   {
+    for my $x (0..$w-1)
+     {
+      $src->put(sprintf('#%02x%02x80', 60*$x, 30*$y), -to => $x, $y);
+     }
+   }
+  my $data = $src->data(-format => 'png -interlace 1');
+  my $one = $mw->Photo(-format => 'png -passes 1', -data => $data);
+  my $six = $mw->Photo(-format => 'png -passes 6', -data => $data);
+  $ok = 0 unless $one->width == $w && $one->height == 8 &&
+                 $six->width == $w && $six->height == 8;
+  for my $y (0..7)
+   {
+    for my $x (0..$w-1)
+     {
+      $ok = 0 unless join(',',$one->get($x,$y)) eq join(',',$src->get(0,0));
+      $ok = 0 unless join(',',$six->get($x,$y)) eq
+                     join(',',$src->get($x,$y & ~1));
+     }
+   }
+  $_->delete for ($src, $one, $six);
+ }
+print "not " unless $ok;
+print "ok 2\n";
+
+open(my $fh, "<", "pngtest.png") || die "Cannot open pngtest.png:$!";
+binmode($fh);
+my $png = do { local $/; <$fh> };
+close($fh);
+my $ref = $mw->Photo(-format => 'png', -data => encode_base64($png));
+my $expect = $ref->data(-format => 'png');
+
+# Read $png with the given format; returns whether the pixels match those
+# of the plain read.
+sub same_read
+{
+ my ($format, $data) = @_;
+ my $img = $mw->Photo(-format => $format,
+                      -data => encode_base64(defined $data ? $data : $png));
+ my $same = ($img->data(-format => 'png') eq $expect);
+ $img->delete;
+ return $same;
+}
+
+# A damaged IHDR checksum is an error unless -crc ignore.
+my $bad = $png;
+substr($bad, 8 + 8 + 13, 1) ^= "\xff";
+$ok = same_read('png -crc check') && same_read('png -crc ignore') &&
+      same_read('png -crc ignore', $bad);
+$ok = 0 if eval { $mw->Photo(-format => 'png', -data => encode_base64($bad)) };
+print "not " unless $ok;
+print "ok 3\n";
+print "not " unless same_read('png -buffersize 1024') &&
+                    same_read('png -buffersize 16777216');
+print "ok 4\n";
+# pngtest.png has a gAMA of 1/2.2, which a display gamma of 2.2 cancels.
+print "not " unless same_read('png -gamma none') && same_read('png -gamma 2.2');
+print "ok 5\n";
+# On a display of gamma 1 the colours come out darker.
+my $dark = $mw->Photo(-format => 'png -gamma 1.0', -data => encode_base64($png));
+my $darker = 0;
+$ok = 1;
+for my $y (0..$ref->height-1)
+ {
+  for my $x (0..$ref->width-1)
+   {
+    my @was = $ref->get($x,$y);
+    my @now = $dark->get($x,$y);
+    for (0..2)
+     {
+      $ok = 0 if $now[$_] > $was[$_];
+      $darker++ if $now[$_] < $was[$_];
+     }
+   }
+ }
+$dark->delete;
+print "not " unless $ok && $darker;
+print "ok 6\n";
+# Whole rows are inflated straight into the photo, other regions are
+# copied in; left and right halves, or top and bottom ones, must join up
+# into the image read at once.
+$ok = 1;
+for my $split ([[0, 0, 45, 69], [45, 0, 91, 69]],
+               [[0, 0, 91, 20], [0, 20, 91, 69]])
+ {
+  my $img = $mw->Photo;
+  for my $from (@$split)
+   {
+    $img->read('pngtest.png', -format => 'png', -from => @$from,
+               -to => @$from[0,1]);
+   }
+  $ok = 0 unless $img->data(-format => 'png') eq $expect;
+  $img->delete;
+ }
+print "not " unless $ok;
+print "ok 7\n";
+# A reduced read keeps every Nth pixel of every Nth row.
+$ok = 1;
+for my $n (2, 4, 8)
+ {
+  my $img = $mw->Photo(-format => 'png -scale ' . 1/$n,
+                       -data => encode_base64($png));
+  $ok = 0 unless $img->width == int((91 + $n - 1) / $n) &&
+                 $img->height == int((69 + $n - 1) / $n);
+  for my $y (0..$img->height-1)
+   {
+    for my $x (0..$img->width-1)
+     {
+      $ok = 0 unless join(',',$img->get($x,$y)) eq
+                     join(',',$ref->get($n*$x,$n*$y));
+     }
+   }
+  $img->delete;
+ }
+print "not " unless $ok;
+print "ok 8\n";
+# A 3x2 16-bit RGB image: -samples16 gives its samples as in the file,
+# and the photo their high bytes. 8-bit images, and regions that lie
+# outside the image, leave the variable empty.
+sub chunk
+{
+ my ($type, $data) = @_;
+ return pack('N', length($data)) . $type . $data . pack('N', crc32($type . $data));
+}
+my @s = map { ($_ * 3851) & 0xffff } 0..17;
+my $png16 = "\211PNG\r\n\032\n" .
+            chunk('IHDR', pack('NNCCCCC', 3, 2, 16, 2, 0, 0, 0)) .
+            chunk('IDAT', compress(join('', map { "\0" . pack('n9', @s[9*$_..9*$_+8]) } 0, 1))) .
+            chunk('IEND', '');
+my $samples;
+my $img = $mw->Photo(-format => ['png', -samples16 => \$samples],
+                     -data => encode_base64($png16));
+$ok = ($samples eq pack('n*', @s));
+for my $y (0, 1)
+ {
+  for my $x (0..2)
+   {
+    $ok = 0 unless join(',',$img->get($x,$y)) eq
+                   join(',',map { $_ >> 8 } @s[9*$y+3*$x..9*$y+3*$x+2]);
+   }
+ }
+$img->delete;
+$img = $mw->Photo(-format => ['png', -samples16 => \$samples],
+                  -data => encode_base64($png));
+$ok = 0 unless defined($samples) && $samples eq '';
+$img->delete;
+$samples = 'x';
+$img = $mw->Photo;
+$img->read('pngtest.png', -format => ['png', -samples16 => \$samples],
+           -from => 91, 0);
+$ok = 0 unless defined($samples) && $samples eq '';
+$img->delete;
+print "not " unless $ok;
+print "ok 9\n";
+# Regular files are mapped into memory rather than read through a
+# channel, and must decode like the same bytes given with -data.
+$ok = 1;
+for my $format ('png', 'png -passes 2', 'png -scale 0.25', 'png -crc ignore')
+ {
+  my $file = $mw->Photo(-format => $format, -file => 'pngtest.png');
+  my $data = $mw->Photo(-format => $format, -data => encode_base64($png));
+  $ok = 0 unless $file->data(-format => 'png') eq $data->data(-format => 'png');
+  $_->delete for ($file, $data);
+ }
+print "not " unless $ok;
+print "ok 10\n";
+# A photo with a fixed -width or -height isn't grown to hold the image,
+# which is then cut off at its edges.
+$ok = 1;
+for my $case ([91, 10, 0], [60, 69, 40])
+ {
+  my ($w, $h, $to) = @$case;
+  my $img = $mw->Photo(-width => $w, -height => $h);
+  $img->read('pngtest.png', -format => 'png', -to => $to, 0);
+  $ok = 0 unless $img->width == $w && $img->height == $h;
+  for my $y (0..$h-1)
+   {
+    for my $x ($to..$w-1)
+     {
+      $ok = 0 unless join(',',$img->get($x,$y)) eq
+                     join(',',$ref->get($x-$to,$y));
+     }
+   }
+  $img->delete;
+ }
+print "not " unless $ok;
+print "ok 11\n";
@@ -0,0 +1,147 @@
+#!perl
+BEGIN
+{
+ $| = 1;
+ print "1..12\n";
+}
+use Tk;
+use Tk::PNG;
+use MIME::Base64;
+print "ok 1\n";
+my $mw = MainWindow->new;
+my $ref = $mw->Photo(-format => "png", -file => "pngtest.png");
+my $expect = $ref->data(-format => 'png');
+
+# Write the reference with the given format and read the data back;
+# returns the PNG data (->data gives it base64 encoded) and whether the
+# pixels came back unchanged.
+sub round_trip
+{
+ my ($format) = @_;
+ my $data = $ref->data(-format => $format);
+ my $img = $mw->Photo(-format => 'png', -data => $data);
+ my $same = ($img->data(-format => 'png') eq $expect);
+ $img->delete;
+ return (decode_base64($data), $same);
+}
+
+my ($data, $same) = round_trip('png -interlace 0');
+print "not " unless $same && Tk::PNG::info($data)->{interlace} == 0;
+print "ok 2\n";
+($data, $same) = round_trip('png -interlace 1');
+print "not " unless $same && Tk::PNG::info($data)->{interlace} == 1;
+print "ok 3\n";
+($data, $same) = round_trip('png Title t -interlace 0 -- -Key v Author a');
+print "not " unless $same &&
+                    join(',',@{Tk::PNG::info($data)->{text}}) eq 'Title,-Key,Author';
+print "ok 4\n";
+my $ok = 1;
+for my $format ('png -compression 0', 'png -compression 9',
+                'png -compression fast', 'png -compression max',
+                'png -compression default')
+ {
+  ($data, $same) = round_trip($format);
+  $ok = 0 unless $same;
+ }
+print "not " unless $ok &&
+     length($ref->data(-format => 'png -compression 0')) >
+     length($ref->data(-format => 'png -compression 9'));
+print "ok 5\n";
+$ok = 1;
+for my $strategy (qw(default filtered huffman rle))
+ {
+  ($data, $same) = round_trip("png -strategy $strategy");
+  $ok = 0 unless $same;
+ }
+print "not " unless $ok;
+print "ok 6\n";
+$ok = 1;
+for my $format ('png -memlevel 1', 'png -memlevel 9',
+                'png -windowbits 8', 'png -windowbits 15',
+                'png -compression 9 -memlevel 1 -windowbits 9')
+ {
+  ($data, $same) = round_trip($format);
+  $ok = 0 unless $same;
+ }
+print "not " unless $ok;
+print "ok 7\n";
+$ok = 1;
+for my $filter (qw(none sub up avg paeth all auto))
+ {
+  for my $interlace (0, 1)
+   {
+    ($data, $same) = round_trip("png -filter $filter -interlace $interlace");
+    $ok = 0 unless $same;
+   }
+ }
+print "not " unless $ok;
+print "ok 8\n";
+# The image data is about 8K, so 1024 byte chunks make several IDATs.
+($data, $same) = round_trip('png -buffersize 1024');
+$ok = $same && (() = $data =~ /IDAT/g) > 4;
+($data, $same) = round_trip('png -buffersize 16777216');
+$ok = 0 unless $same && (() = $data =~ /IDAT/g) == 1;
+print "not " unless $ok;
+print "ok 9\n";
+# Zoomed four times pngtest.png has about 400K of image data, which the
+# threads compress in several pieces. Returns whether each format reads
+# back the same as the serial writer.
+my $big = $mw->Photo;
+$big->copy($ref, -zoom => 4);
+my $serial = $big->data(-format => 'png');
+sub same_as_serial
+{
+ my $ok = 1;
+ for my $format (@_)
+  {
+   my $img = $mw->Photo(-format => 'png',
+                        -data => $big->data(-format => $format));
+   $ok = 0 unless $img->data(-format => 'png') eq $serial;
+   $img->delete;
+  }
+ return $ok;
+}
+
+print "not " unless same_as_serial('png -threads 1', 'png -threads 4',
+                                   'png -threads 8 -compression 9',
+                                   'png -threads 2 -compression 0',
+                                   'png -threads 2 -windowbits 8 -memlevel 1',
+                                   'png -threads 3 -interlace 0 -buffersize 1024');
+print "ok 10\n";
+# The workers also filter the rows, with each filter and interlaced or not.
+$ok = 1;
+for my $filter (qw(none sub up avg paeth all auto))
+ {
+  $ok = 0 unless same_as_serial("png -threads 4 -filter $filter -interlace 0",
+                                "png -threads 3 -filter $filter -interlace 1");
+ }
+print "not " unless $ok;
+print "ok 11\n";
+# A fully opaque photo is written as RGB without its alpha bytes.
+my $opaque = $mw->Photo(-width => 20, -height => 10);
+for my $y (0..9)
+ {
+  for my $x (0..19)
+   {
+    $opaque->put(sprintf('#%02x%02x%02x', 12*$x, 25*$y, 255-12*$x), -to => $x, $y);
+   }
+ }
+$ok = 1;
+for my $format ('png', 'png -interlace 0', 'png -filter auto',
+                'png -threads 2')
+ {
+  my $data = $opaque->data(-format => $format);
+  $ok = 0 unless Tk::PNG::info(decode_base64($data))->{color_type} == 2;
+  my $img = $mw->Photo(-format => 'png', -data => $data);
+  for my $y (0..9)
+   {
+    for my $x (0..19)
+     {
+      $ok = 0 unless join(',',$img->get($x,$y)) eq
+                     join(',',$opaque->get($x,$y));
+     }
+   }
+  $img->delete;
+ }
+print "not " unless $ok;
+print "ok 12\n";